@@ -0,0 +1,322 @@
+#!/usr/bin/env bash
+#
+# End-to-end load test of the module, all on the local machine.
+#
+# Builds nginx with the module, or takes a built binary, starts a stub
+# upstream which answers with $HEADERS response headers, among them the
+# built-in hidden ones, and a proxy in front of it in one of these setups:
+#
+#   off      security_headers off
+#   on       security_headers on
+#   tokens   security_headers on and hide_server_tokens on
+#   manual   add_header and proxy_hide_header giving the same headers
+#
+# Each setup is loaded with h2load over HTTP/1.1 and HTTP/2 (h2c with prior
+# knowledge); the requests per second and the p50 and p99 latencies are
+# computed from the per-request log.
+#
+#   NGX_SRC=/path/to/nginx bench/e2e/run.sh > e2e_output.txt
+#   NGINX=/path/to/objs/nginx bench/e2e/run.sh
+#
+# The stub upstream runs in its own nginx, so its workers can be kept off
+# the CPUs of the proxy with UPSTREAM_CPUS and PROXY_CPUS, see taskset(1).
+
+set -euo pipefail
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+REPO=$(cd "$HERE/../.." && pwd)
+WORK=${WORK:-$HERE/work}
+
+HEADERS=${HEADERS:-20}
+DURATION=${DURATION:-10}
+WARMUP=${WARMUP:-2}
+CONNECTIONS=${CONNECTIONS:-64}
+STREAMS=${STREAMS:-10}
+THREADS=${THREADS:-2}
+WORKERS=${WORKERS:-1}
+SETUPS=${SETUPS:-off on tokens manual}
+PROTOCOLS=${PROTOCOLS:-h1 h2}
+
+PROXY_PORT=${PROXY_PORT:-18080}
+PROXY_H2_PORT=${PROXY_H2_PORT:-18082}
+UPSTREAM_PORT=${UPSTREAM_PORT:-18081}
+
+# the built-in hidden headers, see hide_headers[] in the module
+
+HIDDEN="X-Powered-By X-CF-Powered-By Via X-Amz-Cf-Id X-Amz-Cf-Pop
+X-Page-Speed X-Varnish X-Cache X-Cache-Hits X-Cache-Status
+X-Application-Version X-Hudson X-Hudson-Theme X-Instance-Identity X-Jenkins
+X-Jenkins-Session X-Envoy-Upstream-Service-Time X-Drupal-Cache X-Generator
+X-Backend-Server X-Wix-Request-Id X-Request-Id X-Sucuri-Id X-Hacker"
+
+
+die() {
+    echo "$*" >&2
+    exit 1
+}
+
+
+build() {
+    [ -n "${NGX_SRC:-}" ] || die "set NGX_SRC to an nginx source tree or NGINX to a binary"
+
+    (cd "$NGX_SRC" \
+        && ./configure --builddir="$WORK/objs" --with-http_v2_module \
+                       --with-threads --add-module="$REPO" > "$WORK/configure.log" \
+        && make -f "$WORK/objs/Makefile" -j"$(nproc)" > "$WORK/make.log") \
+        || die "nginx build failed, see $WORK/configure.log and $WORK/make.log"
+
+    NGINX=$WORK/objs/nginx
+}
+
+
+# nginx 1.25.1 replaced "listen ... http2" with the http2 directive
+
+h2_listen() {
+    local version
+
+    version=$("$NGINX" -v 2>&1 | sed -n 's|.*nginx/\([0-9.]*\).*|\1|p')
+
+    if [ "$(printf '%s\n1.25.1\n' "$version" | sort -V | head -n 1)" = 1.25.1 ]
+    then
+        echo "listen 127.0.0.1:$PROXY_H2_PORT backlog=4096; http2 on;"
+    else
+        echo "listen 127.0.0.1:$PROXY_H2_PORT backlog=4096 http2;"
+    fi
+}
+
+
+# the compiled in paths may not be writable
+
+prefix_conf() {
+    local dir=$1
+
+    cat <<EOF
+worker_processes $WORKERS;
+pid $dir/nginx.pid;
+error_log $dir/error.log warn;
+
+events {
+    worker_connections 4096;
+}
+
+http {
+    access_log off;
+    client_body_temp_path $dir/client_body_temp;
+    proxy_temp_path $dir/proxy_temp;
+    fastcgi_temp_path $dir/fastcgi_temp;
+    uwsgi_temp_path $dir/uwsgi_temp;
+    scgi_temp_path $dir/scgi_temp;
+EOF
+}
+
+
+upstream_conf() {
+    local i n name
+
+    prefix_conf "$WORK/upstream"
+
+    cat <<EOF
+    default_type text/html;
+
+    keepalive_requests 1000000;
+
+    server {
+        listen 127.0.0.1:$UPSTREAM_PORT backlog=4096;
+
+        location / {
+            add_header X-Frame-Options ALLOWALL;
+            add_header X-XSS-Protection "1; mode=block";
+EOF
+
+    n=2
+
+    for name in $HIDDEN; do
+        [ "$n" -lt "$HEADERS" ] || break
+        echo "            add_header $name stub;"
+        n=$((n + 1))
+    done
+
+    for ((i = n; i < HEADERS; i++)); do
+        echo "            add_header X-App-Header-$i $i;"
+    done
+
+    cat <<EOF
+            return 200 "ok\n";
+        }
+    }
+}
+EOF
+}
+
+
+proxy_conf() {
+    local setup=$1
+
+    prefix_conf "$WORK/proxy"
+
+    cat <<EOF
+    keepalive_requests 1000000;
+    http2_max_concurrent_streams 1024;
+
+    upstream stub {
+        server 127.0.0.1:$UPSTREAM_PORT;
+        keepalive 256;
+    }
+
+    server {
+        listen 127.0.0.1:$PROXY_PORT backlog=4096;
+$(proxy_location "$setup")
+    }
+
+    server {
+        $(h2_listen)
+$(proxy_location "$setup")
+    }
+}
+EOF
+}
+
+
+proxy_location() {
+    local setup=$1 name
+
+    cat <<EOF
+        location / {
+            proxy_pass http://stub;
+            proxy_http_version 1.1;
+            proxy_set_header Connection "";
+EOF
+
+    case $setup in
+    off)
+        echo "            security_headers off;"
+        ;;
+    on)
+        echo "            security_headers on;"
+        ;;
+    tokens)
+        echo "            security_headers on;"
+        echo "            hide_server_tokens on;"
+        ;;
+    manual)
+        cat <<EOF
+            server_tokens off;
+            proxy_hide_header X-Frame-Options;
+            proxy_hide_header X-XSS-Protection;
+            add_header X-Frame-Options SAMEORIGIN always;
+            add_header X-Content-Type-Options nosniff always;
+            add_header Referrer-Policy strict-origin-when-cross-origin always;
+            add_header Cross-Origin-Resource-Policy same-site always;
+EOF
+        for name in $HIDDEN; do
+            echo "            proxy_hide_header $name;"
+        done
+        ;;
+    esac
+
+    echo "        }"
+}
+
+
+start() {
+    local dir=$1 cpus=$2
+
+    mkdir -p "$dir"
+
+    if [ -n "$cpus" ]; then
+        taskset -c "$cpus" "$NGINX" -p "$dir" -e "$dir/error.log" \
+                                    -c "$dir/nginx.conf"
+    else
+        "$NGINX" -p "$dir" -e "$dir/error.log" -c "$dir/nginx.conf"
+    fi
+}
+
+
+stop() {
+    local dir=$1
+
+    [ -f "$dir/nginx.pid" ] || return 0
+
+    "$NGINX" -p "$dir" -e "$dir/error.log" -c "$dir/nginx.conf" -s quit \
+        || true
+
+    while [ -f "$dir/nginx.pid" ]; do
+        sleep 0.1
+    done
+}
+
+
+cleanup() {
+    stop "$WORK/proxy"
+    stop "$WORK/upstream"
+}
+
+
+# prints the requests per second, p50 and p99 in milliseconds
+
+load() {
+    local proto=$1 url log out rps
+
+    log=$WORK/h2load.log
+    rm -f "$log"
+
+    if [ "$proto" = h1 ]; then
+        url=http://127.0.0.1:$PROXY_PORT/
+        out=$(h2load --h1 -t "$THREADS" -c "$CONNECTIONS" -D "$DURATION" \
+                     --warm-up-time "$WARMUP" --log-file "$log" "$url")
+    else
+        url=http://127.0.0.1:$PROXY_H2_PORT/
+        out=$(h2load -t "$THREADS" -c "$CONNECTIONS" -m "$STREAMS" \
+                     -D "$DURATION" --warm-up-time "$WARMUP" \
+                     --log-file "$log" "$url")
+    fi
+
+    echo "$out" | grep -q "0 failed, 0 errored" \
+        || { echo "$out" >&2; die "$proto requests failed"; }
+
+    rps=$(echo "$out" | sed -n 's|^finished in .*, \([0-9.]*\) req/s.*|\1|p')
+
+    cut -f3 "$log" | sort -n | awk -v rps="$rps" '
+        { t[NR] = $1 }
+        END {
+            p50 = t[int(NR * 0.50) > 0 ? int(NR * 0.50) : 1]
+            p99 = t[int(NR * 0.99) > 0 ? int(NR * 0.99) : 1]
+            printf "%12.1f %10.3f %10.3f\n", rps, p50 / 1000, p99 / 1000
+        }'
+}
+
+
+command -v h2load > /dev/null || die "h2load from nghttp2 is required"
+
+mkdir -p "$WORK"
+
+if [ -z "${NGINX:-}" ]; then
+    build
+fi
+
+trap cleanup EXIT
+
+mkdir -p "$WORK/upstream" "$WORK/proxy"
+
+upstream_conf > "$WORK/upstream/nginx.conf"
+"$NGINX" -t -q -p "$WORK/upstream" -e "$WORK/upstream/error.log" \
+         -c "$WORK/upstream/nginx.conf"
+start "$WORK/upstream" "${UPSTREAM_CPUS:-}"
+
+echo "# $("$NGINX" -v 2>&1), $HEADERS upstream headers, $WORKERS workers,"
+echo "# $CONNECTIONS connections, $STREAMS streams, ${DURATION}s"
+printf "%-8s %-6s %12s %10s %10s\n" setup proto "req/s" "p50 ms" "p99 ms"
+
+for setup in $SETUPS; do
+
+    proxy_conf "$setup" > "$WORK/proxy/nginx.conf"
+    "$NGINX" -t -q -p "$WORK/proxy" -e "$WORK/proxy/error.log" \
+             -c "$WORK/proxy/nginx.conf"
+    start "$WORK/proxy" "${PROXY_CPUS:-}"
+
+    for proto in $PROTOCOLS; do
+        printf "%-8s %-6s %s\n" "$setup" "$proto" "$(load "$proto")"
+    done
+
+    stop "$WORK/proxy"
+done
@@ -0,0 +1,772 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+/*
+ * Microbenchmark of the header filter.
+ *
+ * The module sources are included, so the static filter and configuration
+ * callbacks are called directly, and linked against the objects of a
+ * configured and built nginx tree, see bench/Makefile.  Every response is
+ * a synthetic request with its own pool; the filter runs with a stub next
+ * filter and the time and the pool bytes it takes are reported per response.
+ */
+
+
+#include "../src/ngx_http_security_headers_module.c"
+#include "../src/ngx_http_security_headers_status.c"
+#include "../src/ngx_http_security_headers_upstream.c"
+#include "../src/ngx_http_security_headers_policy.c"
+#include "../src/ngx_http_security_headers_report.c"
+#include "../src/ngx_http_security_headers_match.c"
+#include "../src/ngx_http_security_headers_cache.c"
+#include "../src/ngx_http_security_headers_learn.c"
+#include "../src/ngx_http_security_headers_nonce.c"
+#include "../src/ngx_http_security_headers_hosts.c"
+#include "../src/ngx_http_security_headers_fetch.c"
+#include "../src/ngx_http_security_headers_cookie.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define BENCH_BATCH  256
+#define BENCH_NAMES  200000
+
+
+typedef struct {
+    ngx_uint_t                 headers;
+    ngx_uint_t                 hide;
+    ngx_flag_t                 tokens;
+    ngx_flag_t                 preserialize;
+    ngx_flag_t                 long_names;
+    ngx_uint_t                 status;
+    char                      *type;
+} ngx_http_security_headers_bench_case_t;
+
+
+static ngx_int_t ngx_http_security_headers_bench_next(ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_bench_directive(ngx_conf_t *cf,
+    void *conf, char *name, char **args, ngx_uint_t nargs);
+static void *ngx_http_security_headers_bench_configure(ngx_conf_t *cf,
+    ngx_http_security_headers_bench_case_t *bc);
+static ngx_http_request_t *ngx_http_security_headers_bench_request(
+    ngx_pool_t *pool, ngx_connection_t *c, void **main_conf, void **loc_conf,
+    ngx_http_security_headers_bench_case_t *bc);
+static size_t ngx_http_security_headers_bench_pool_used(ngx_pool_t *pool);
+static ngx_int_t ngx_http_security_headers_bench_run(ngx_log_t *log,
+    ngx_http_security_headers_bench_case_t *bc, ngx_uint_t n);
+static ngx_int_t ngx_http_security_headers_bench_verify(ngx_log_t *log);
+static ngx_http_security_headers_action_t *
+    ngx_http_security_headers_bench_reference(
+    ngx_http_security_headers_main_conf_t *smcf, u_char *name, size_t len,
+    ngx_http_security_headers_action_t *set);
+static size_t ngx_http_security_headers_bench_name(u_char *p,
+    ngx_http_security_headers_main_conf_t *smcf);
+
+
+static ngx_uint_t  bench_headers[] = { 8, 16, 32, 64 };
+static ngx_uint_t  bench_hide[] = { 0, 64, 512 };
+static ngx_flag_t  bench_tokens[] = { 0, 1 };
+static ngx_flag_t  bench_preserialize[] = { 0, 1 };
+static ngx_uint_t  bench_status[] = { 200, 304, 404 };
+static char       *bench_types[] = {
+    "text/html; charset=utf-8", "application/json", "image/png"
+};
+
+#define bench_nelts(a)  (sizeof(a) / sizeof(a[0]))
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    ngx_uint_t                               n, h, d, t, p, s, c;
+    ngx_log_t                                log;
+    ngx_open_file_t                          file;
+    ngx_http_security_headers_bench_case_t   bc;
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 100000;
+
+    if (n < BENCH_BATCH) {
+        n = BENCH_BATCH;
+    }
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    for (ngx_pagesize_shift = 0;
+         (ngx_uint_t) (1 << ngx_pagesize_shift) < ngx_pagesize;
+         ngx_pagesize_shift++)
+    {
+        /* void */
+    }
+
+    ngx_time_init();
+
+    ngx_memzero(&file, sizeof(ngx_open_file_t));
+    file.fd = ngx_stderr;
+
+    ngx_memzero(&log, sizeof(ngx_log_t));
+    log.file = &file;
+    log.log_level = NGX_LOG_ERR;
+
+    ngx_http_next_header_filter = ngx_http_security_headers_bench_next;
+
+    if (ngx_http_security_headers_bench_verify(&log) != NGX_OK) {
+        return 1;
+    }
+
+    ngx_http_security_headers_match_init(&log);
+
+    printf("%8s %6s %6s %6s %6s %-26s %12s %12s\n",
+           "headers", "hide", "tokens", "serial", "status", "content type",
+           "ns/response", "bytes/resp");
+
+    for (h = 0; h < bench_nelts(bench_headers); h++) {
+    for (d = 0; d < bench_nelts(bench_hide); d++) {
+    for (t = 0; t < bench_nelts(bench_tokens); t++) {
+    for (p = 0; p < bench_nelts(bench_preserialize); p++) {
+    for (s = 0; s < bench_nelts(bench_status); s++) {
+    for (c = 0; c < bench_nelts(bench_types); c++) {
+
+        bc.headers = bench_headers[h];
+        bc.hide = bench_hide[d];
+        bc.tokens = bench_tokens[t];
+        bc.preserialize = bench_preserialize[p];
+        bc.status = bench_status[s];
+        bc.type = bench_types[c];
+
+        if (ngx_http_security_headers_bench_run(&log, &bc, n) != NGX_OK) {
+            return 1;
+        }
+    }
+    }
+    }
+    }
+    }
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_bench_run(ngx_log_t *log,
+    ngx_http_security_headers_bench_case_t *bc, ngx_uint_t n)
+{
+    size_t                     bytes;
+    uint64_t                   ns;
+    ngx_uint_t                 i, done;
+    ngx_conf_t                 cf;
+    ngx_pool_t                *pool, *pools[BENCH_BATCH];
+    ngx_connection_t           c;
+    struct timespec            start, end;
+    ngx_http_conf_ctx_t        ctx;
+    ngx_http_request_t        *r[BENCH_BATCH];
+
+    void  *main_conf[1], *loc_conf[1];
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    pool = ngx_create_pool(NGX_CYCLE_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    cf.pool = pool;
+    cf.temp_pool = pool;
+    cf.log = log;
+    cf.ctx = &ctx;
+
+    ngx_http_security_headers_module.ctx_index = 0;
+
+    ctx.main_conf = main_conf;
+    ctx.srv_conf = NULL;
+    ctx.loc_conf = loc_conf;
+
+    main_conf[0] = ngx_http_security_headers_create_main_conf(&cf);
+    if (main_conf[0] == NULL) {
+        return NGX_ERROR;
+    }
+
+    loc_conf[0] = ngx_http_security_headers_bench_configure(&cf, bc);
+    if (loc_conf[0] == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+    c.log = log;
+
+    ns = 0;
+    bytes = 0;
+
+    for (done = 0; done < n; done += BENCH_BATCH) {
+
+        for (i = 0; i < BENCH_BATCH; i++) {
+            pools[i] = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, log);
+            if (pools[i] == NULL) {
+                return NGX_ERROR;
+            }
+
+            r[i] = ngx_http_security_headers_bench_request(pools[i], &c,
+                                                           main_conf,
+                                                           loc_conf, bc);
+            if (r[i] == NULL) {
+                return NGX_ERROR;
+            }
+
+            bytes -= ngx_http_security_headers_bench_pool_used(pools[i]);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < BENCH_BATCH; i++) {
+            if (ngx_http_security_headers_filter(r[i]) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        ns += (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000
+              + end.tv_nsec - start.tv_nsec;
+
+        for (i = 0; i < BENCH_BATCH; i++) {
+            bytes += ngx_http_security_headers_bench_pool_used(pools[i]);
+            ngx_destroy_pool(pools[i]);
+        }
+    }
+
+    printf("%8lu %6lu %6s %6s %6lu %-26s %12.1f %12.1f\n",
+           (unsigned long) bc->headers, (unsigned long) bc->hide,
+           bc->tokens ? "on" : "off", bc->preserialize ? "on" : "off",
+           (unsigned long) bc->status, bc->type,
+           (double) ns / done, (double) bytes / done);
+
+    ngx_destroy_pool(pool);
+
+    return NGX_OK;
+}
+
+
+/*
+ * Differential check of the name matchers.  The names are placed at random
+ * offsets of a page, and at its very end so the matchers which read past
+ * the name take their copying path.  The location also hides a 60-byte
+ * name and a 60-byte prefix, which the name tables must take.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_bench_verify(ngx_log_t *log)
+{
+    u_char                                 *page, *name;
+    size_t                                  len;
+    uint64_t                                ns;
+    ngx_uint_t                              i, m, k, nmatchers;
+    ngx_conf_t                              cf;
+    ngx_pool_t                             *pool;
+    struct timespec                         start, end;
+    ngx_http_conf_ctx_t                     ctx;
+    ngx_http_security_headers_action_t     *got, *want, set;
+    ngx_http_security_headers_loc_conf_t   *slcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+    ngx_http_security_headers_bench_case_t  bc;
+
+    void    *main_conf[1], *loc_conf[1];
+    u_char   buf[NGX_HTTP_SECURITY_HEADERS_NAME_LEN];
+
+    static struct {
+        char                                *name;
+        ngx_http_security_headers_match_pt   match;
+    } matchers[] = {
+        { "scalar", ngx_http_security_headers_match_scalar },
+#if (NGX_HTTP_SECURITY_HEADERS_SSE2)
+        { "sse2", ngx_http_security_headers_match_sse2 },
+#endif
+#if (NGX_HTTP_SECURITY_HEADERS_AVX2)
+        { "avx2", ngx_http_security_headers_match_avx2 },
+#endif
+    };
+
+    nmatchers = bench_nelts(matchers);
+
+#if (NGX_HTTP_SECURITY_HEADERS_AVX2)
+    __builtin_cpu_init();
+
+    if (!__builtin_cpu_supports("avx2")) {
+        nmatchers--;
+    }
+#endif
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    pool = ngx_create_pool(NGX_CYCLE_POOL_SIZE, log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    cf.pool = pool;
+    cf.temp_pool = pool;
+    cf.log = log;
+    cf.ctx = &ctx;
+
+    ctx.main_conf = main_conf;
+    ctx.srv_conf = NULL;
+    ctx.loc_conf = loc_conf;
+
+    main_conf[0] = ngx_http_security_headers_create_main_conf(&cf);
+    if (main_conf[0] == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&bc, sizeof(ngx_http_security_headers_bench_case_t));
+    bc.hide = 64;
+    bc.long_names = 1;
+
+    loc_conf[0] = ngx_http_security_headers_bench_configure(&cf, &bc);
+    if (loc_conf[0] == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf = main_conf[0];
+    slcf = loc_conf[0];
+
+    page = ngx_memalign(4096, 2 * 4096, log);
+    if (page == NULL) {
+        return NGX_ERROR;
+    }
+
+    printf("%8s %12s\n", "matcher", "ns/name");
+
+    for (m = 0; m < nmatchers; m++) {
+
+        srandom(1);
+        ns = 0;
+
+        for (i = 0; i < BENCH_NAMES; i++) {
+
+            name = page + ((i & 1) ? (ngx_uint_t) random() % (4096 - 64)
+                                   : 4096 - 64);
+            len = ngx_http_security_headers_bench_name(name, smcf);
+
+            if (!(i & 1)) {
+                ngx_memmove(page + 4096 - len, name, len);
+                name = page + 4096 - len;
+            }
+
+            want = ngx_http_security_headers_bench_reference(smcf, name, len,
+                                                             &set);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            got = matchers[m].match(slcf->names, name, len, buf);
+
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            ns += (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000
+                  + end.tv_nsec - start.tv_nsec;
+
+            for (k = 0;
+                 k < len && k < NGX_HTTP_SECURITY_HEADERS_ROW
+                 && buf[k] == ngx_tolower(name[k]);
+                 k++)
+            {
+                /* void */
+            }
+
+            if ((got == NULL) != (want == NULL)
+                || (got && (got->action != want->action
+                            || got->index != want->index))
+                || k < ngx_min(len, NGX_HTTP_SECURITY_HEADERS_ROW))
+            {
+                printf("%s matcher mismatch on \"%.*s\"\n",
+                       matchers[m].name, (int) len, name);
+                return NGX_ERROR;
+            }
+        }
+
+        printf("%8s %12.1f\n", matchers[m].name, (double) ns / BENCH_NAMES);
+    }
+
+    printf("\n");
+
+    ngx_free(page);
+    ngx_destroy_pool(pool);
+
+    return NGX_OK;
+}
+
+
+static ngx_http_security_headers_action_t *
+ngx_http_security_headers_bench_reference(
+    ngx_http_security_headers_main_conf_t *smcf, u_char *name, size_t len,
+    ngx_http_security_headers_action_t *set)
+{
+    ngx_str_t                           *key;
+    ngx_uint_t                           i;
+    ngx_http_security_headers_hidden_t  *hidden;
+
+    for (i = 0; i < NGX_HTTP_SECURITY_HEADERS_MANAGED; i++) {
+        key = &ngx_http_security_headers_managed[i].lowcase_key;
+
+        if (key->len == len && ngx_strncasecmp(name, key->data, len) == 0) {
+            set->action = NGX_HTTP_SECURITY_HEADERS_ACTION_SET;
+            set->index = i;
+            return set;
+        }
+    }
+
+    hidden = smcf->hidden.elts;
+
+    for (i = 0; i < smcf->hidden.nelts; i++) {
+        if (!hidden[i].prefix && hidden[i].name.len == len
+            && ngx_strncasecmp(name, hidden[i].name.data, len) == 0)
+        {
+            return &hidden[i].action;
+        }
+    }
+
+    /* set-cookie, for security_headers_cookie_flags, unless it is hidden */
+
+    key = &ngx_http_security_headers_cookie_name;
+
+    if (key->len == len && ngx_strncasecmp(name, key->data, len) == 0) {
+        return &ngx_http_security_headers_cookie_action;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * A random header name: a known one in random case, set-cookie included,
+ * one with a byte changed, one byte shorter or longer, or random bytes.
+ */
+
+static size_t
+ngx_http_security_headers_bench_name(u_char *p,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    size_t                               len;
+    ngx_str_t                           *known;
+    ngx_uint_t                           i, n;
+    ngx_http_security_headers_hidden_t  *hidden;
+
+    static u_char  bytes[] = "abcdexyzABCDEXYZ-_019@[`{\x80\xc0\xe1\xff";
+
+    n = (ngx_uint_t) random() % (NGX_HTTP_SECURITY_HEADERS_MANAGED
+                                 + smcf->hidden.nelts + 1);
+
+    if (n < NGX_HTTP_SECURITY_HEADERS_MANAGED) {
+        known = &ngx_http_security_headers_managed[n].lowcase_key;
+
+    } else if (n == NGX_HTTP_SECURITY_HEADERS_MANAGED + smcf->hidden.nelts) {
+        known = &ngx_http_security_headers_cookie_name;
+
+    } else {
+        hidden = smcf->hidden.elts;
+        known = &hidden[n - NGX_HTTP_SECURITY_HEADERS_MANAGED].name;
+    }
+
+    len = known->len;
+
+    for (i = 0; i < len; i++) {
+        p[i] = (random() & 1) ? ngx_toupper(known->data[i]) : known->data[i];
+    }
+
+    switch (random() % 5) {
+
+    case 0:
+        p[random() % len] = bytes[random() % (sizeof(bytes) - 1)];
+        break;
+
+    case 1:
+        if (len > 1) {
+            len--;
+        }
+        break;
+
+    case 2:
+        p[len++] = bytes[random() % (sizeof(bytes) - 1)];
+        break;
+
+    case 3:
+        len = 1 + random() % (NGX_HTTP_SECURITY_HEADERS_NAME_LEN - 1);
+
+        for (i = 0; i < len; i++) {
+            p[i] = bytes[random() % (sizeof(bytes) - 1)];
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return len;
+}
+
+
+/*
+ * The location is configured through the module directives, the way
+ * nginx.conf would do: security_headers on, hide_server_tokens and
+ * security_headers_preserialize as requested and bc->hide extra names in
+ * security_headers_hide, and with bc->long_names a name and a prefix close
+ * to the longest allowed.  As in
+ * nginx, the main configuration is initialized after the directives.
+ */
+
+static void *
+ngx_http_security_headers_bench_configure(ngx_conf_t *cf,
+    ngx_http_security_headers_bench_case_t *bc)
+{
+    u_char      *p;
+    ngx_uint_t   i;
+    void        *prev, *conf;
+    char        *on[] = { "on" }, *off[] = { "off" }, **names;
+
+    static char  *long_name[] = {
+        "x-vendor-debug-trace-identifier-of-the-upstream-request-0001"
+    };
+    static char  *long_prefix[] = {
+        "x-vendor-debug-trace-identifier-of-the-upstream-request-pref*"
+    };
+
+    prev = ngx_http_security_headers_create_loc_conf(cf);
+    conf = ngx_http_security_headers_create_loc_conf(cf);
+
+    if (prev == NULL || conf == NULL) {
+        return NULL;
+    }
+
+    if (ngx_http_security_headers_bench_directive(cf, conf,
+                                                  "security_headers", on, 1)
+        != NGX_OK
+        || ngx_http_security_headers_bench_directive(cf, conf,
+               "hide_server_tokens", bc->tokens ? on : off, 1)
+           != NGX_OK
+        || ngx_http_security_headers_bench_directive(cf, conf,
+               "security_headers_preserialize", bc->preserialize ? on : off, 1)
+           != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (bc->hide) {
+        names = ngx_palloc(cf->pool, bc->hide * sizeof(char *));
+        if (names == NULL) {
+            return NULL;
+        }
+
+        for (i = 0; i < bc->hide; i++) {
+            p = ngx_pnalloc(cf->pool, sizeof("x-vendor-leak-") + NGX_INT_T_LEN);
+            if (p == NULL) {
+                return NULL;
+            }
+
+            *ngx_sprintf(p, "x-vendor-leak-%ui", i) = '\0';
+            names[i] = (char *) p;
+        }
+
+        if (ngx_http_security_headers_bench_directive(cf, conf,
+                "security_headers_hide", names, bc->hide)
+            != NGX_OK)
+        {
+            return NULL;
+        }
+    }
+
+    if (bc->long_names
+        && (ngx_http_security_headers_bench_directive(cf, conf,
+                "security_headers_hide", long_name, 1)
+            != NGX_OK
+            || ngx_http_security_headers_bench_directive(cf, conf,
+                   "security_headers_hide_prefix", long_prefix, 1)
+               != NGX_OK))
+    {
+        return NULL;
+    }
+
+    if (ngx_http_security_headers_init_main_conf(cf,
+            ngx_http_conf_get_module_main_conf(cf,
+                                           ngx_http_security_headers_module))
+        != NGX_CONF_OK
+        || ngx_http_security_headers_merge_loc_conf(cf, prev, conf)
+           != NGX_CONF_OK)
+    {
+        return NULL;
+    }
+
+    return conf;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_bench_directive(ngx_conf_t *cf, void *conf,
+    char *name, char **args, ngx_uint_t nargs)
+{
+    ngx_str_t      *value;
+    ngx_uint_t      i;
+    ngx_command_t  *cmd;
+
+    for (cmd = ngx_http_security_headers_commands; cmd->name.len; cmd++) {
+        if (ngx_strcmp(cmd->name.data, name) == 0) {
+            break;
+        }
+    }
+
+    if (cmd->name.len == 0) {
+        return NGX_ERROR;
+    }
+
+    cf->args = ngx_array_create(cf->pool, nargs + 1, sizeof(ngx_str_t));
+    if (cf->args == NULL) {
+        return NGX_ERROR;
+    }
+
+    value = ngx_array_push_n(cf->args, nargs + 1);
+    if (value == NULL) {
+        return NGX_ERROR;
+    }
+
+    value[0] = cmd->name;
+
+    for (i = 0; i < nargs; i++) {
+        value[i + 1].len = ngx_strlen(args[i]);
+        value[i + 1].data = ngx_pnalloc(cf->pool, value[i + 1].len);
+
+        if (value[i + 1].data == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(value[i + 1].data, args[i], value[i + 1].len);
+    }
+
+    if (cmd->set(cf, cmd, conf) != NGX_CONF_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * A response as an upstream would produce it: a few common headers, one
+ * managed header to replace, a couple of built-in and configured hidden
+ * headers, and plain application headers to fill up bc->headers.
+ */
+
+static ngx_http_request_t *
+ngx_http_security_headers_bench_request(ngx_pool_t *pool, ngx_connection_t *c,
+    void **main_conf, void **loc_conf,
+    ngx_http_security_headers_bench_case_t *bc)
+{
+    u_char              *p;
+    ngx_uint_t           i;
+    ngx_table_elt_t     *h;
+    ngx_http_request_t  *r;
+
+    static ngx_str_t  fixed[][2] = {
+        { ngx_string("Date"), ngx_string("Thu, 01 Jan 1970 00:00:00 GMT") },
+        { ngx_string("Cache-Control"), ngx_string("max-age=3600") },
+        { ngx_string("X-Frame-Options"), ngx_string("ALLOWALL") },
+        { ngx_string("X-Powered-By"), ngx_string("PHP/8.3.0") },
+        { ngx_string("X-Vendor-Leak-0"), ngx_string("node-17") },
+        { ngx_string("Vary"), ngx_string("Accept-Encoding") }
+    };
+
+    r = ngx_pcalloc(pool, sizeof(ngx_http_request_t));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->pool = pool;
+    r->connection = c;
+    r->main = r;
+    r->main_conf = main_conf;
+    r->loc_conf = loc_conf;
+    r->http_version = NGX_HTTP_VERSION_11;
+
+    r->ctx = ngx_pcalloc(pool, sizeof(void *));
+    if (r->ctx == NULL) {
+        return NULL;
+    }
+
+    if (ngx_list_init(&r->headers_out.headers, pool, 20,
+                      sizeof(ngx_table_elt_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    r->headers_out.status = bc->status;
+    r->headers_out.content_type.data = (u_char *) bc->type;
+    r->headers_out.content_type.len = ngx_strlen(bc->type);
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+
+    p = (u_char *) ngx_strchr(bc->type, ';');
+    if (p) {
+        r->headers_out.content_type_len = p - (u_char *) bc->type;
+    }
+
+    for (i = 0; i < bc->headers; i++) {
+
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NULL;
+        }
+
+        h->hash = 1;
+        h->lowcase_key = NULL;
+#if (nginx_version >= 1023000)
+        h->next = NULL;
+#endif
+
+        if (i < bench_nelts(fixed)) {
+            h->key = fixed[i][0];
+            h->value = fixed[i][1];
+            continue;
+        }
+
+        p = ngx_pnalloc(pool, sizeof("X-App-Header-") + NGX_INT_T_LEN);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        h->key.data = p;
+        h->key.len = ngx_sprintf(p, "X-App-Header-%ui", i) - p;
+        ngx_str_set(&h->value, "1");
+    }
+
+    return r;
+}
+
+
+static size_t
+ngx_http_security_headers_bench_pool_used(ngx_pool_t *pool)
+{
+    size_t              used;
+    ngx_pool_t         *p;
+    ngx_pool_large_t   *l;
+
+    used = 0;
+
+    for (p = pool; p; p = p->d.next) {
+        used += p->d.last - (u_char *) p;
+    }
+
+    for (l = pool->large; l; l = l->next) {
+        if (l->alloc) {
+            used += sizeof(ngx_pool_large_t);
+        }
+    }
+
+    return used;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_bench_next(ngx_http_request_t *r)
+{
+    return NGX_OK;
+}
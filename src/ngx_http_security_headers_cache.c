@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * With security_headers_cache, a worker remembers the cache entries whose
+ * stored headers have none of the managed or hidden names, nor Set-Cookie,
+ * which is the usual case with security_headers_hide_upstream.  A hit on
+ * such an entry skips the header walk and only gets the managed headers
+ * selected for the response, so the status, the content type and the HTTPS
+ * checks still apply per request.
+ *
+ * nginx stores the upstream header block in the cache file as it came,
+ * so the entries cannot be cleaned in place.  A memo is made on a hit and
+ * names the cache file and its date, so a refreshed entry is walked again,
+ * as is the next hit after a reload or a runtime policy change, which come
+ * with a new plan or policy version, and a hit in a location with other
+ * names to hide.  Adding $security_headers_policy_version to the cache key
+ * sends responses with new policy versions to new cache entries.
+ */
+
+
+#if (NGX_HTTP_CACHE)
+
+#define NGX_HTTP_SECURITY_HEADERS_MEMO  4096
+
+
+ngx_int_t
+ngx_http_security_headers_cache_init_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    smcf->memo = ngx_pcalloc(cycle->pool, NGX_HTTP_SECURITY_HEADERS_MEMO
+                                      * sizeof(ngx_http_security_headers_memo_t));
+    if (smcf->memo == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Finds the memo of a cached response, and if it is clean under the plan,
+ * the names table of the location and the version of the runtime policy,
+ * if any
+ */
+
+ngx_http_security_headers_memo_t *
+ngx_http_security_headers_cache_lookup(ngx_http_request_t *r,
+    ngx_http_security_headers_main_conf_t *smcf, ngx_array_t *plan,
+    ngx_http_security_headers_runtime_t *rt, ngx_uint_t *clean)
+{
+    uint64_t                               key;
+    ngx_uint_t                             version;
+    ngx_http_cache_t                      *c;
+    ngx_http_security_headers_memo_t      *memo;
+    ngx_http_security_headers_loc_conf_t  *slcf;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+
+    c = r->cache;
+
+    ngx_memcpy(&key, c->key, sizeof(uint64_t));
+
+    memo = &smcf->memo[key % NGX_HTTP_SECURITY_HEADERS_MEMO];
+    version = rt ? rt->version : 0;
+
+    *clean = (memo->key == key && memo->uniq == c->uniq
+              && memo->date == c->date && memo->plan == plan
+              && memo->names == slcf->names && memo->version == version);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: cache hit, memo %s",
+                   *clean ? "clean" : "none");
+
+    return memo;
+}
+
+
+/* Records the result of a header walk, only clean entries are kept */
+
+void
+ngx_http_security_headers_cache_record(ngx_http_request_t *r,
+    ngx_http_security_headers_memo_t *memo, ngx_array_t *plan,
+    ngx_http_security_headers_runtime_t *rt, ngx_uint_t clean)
+{
+    ngx_http_cache_t                      *c;
+    ngx_http_security_headers_loc_conf_t  *slcf;
+
+    if (!clean) {
+        memo->plan = NULL;
+        return;
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+
+    c = r->cache;
+
+    ngx_memcpy(&memo->key, c->key, sizeof(uint64_t));
+    memo->uniq = c->uniq;
+    memo->date = c->date;
+    memo->plan = plan;
+    memo->names = slcf->names;
+    memo->version = rt ? rt->version : 0;
+}
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_cookie_flags adds the Secure, HttpOnly and SameSite
+ * attributes a Set-Cookie header lacks, as the header filter walks the
+ * response headers.  The attribute names are matched in place, a word at
+ * a time; a cookie which has all of the attributes is left as is, others
+ * are copied once, with the missing attributes appended.  A SameSite
+ * attribute of the cookie is kept, whatever its value.
+ */
+
+
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_CASE  0x2020202020202020ULL
+
+
+static ngx_uint_t ngx_http_security_headers_cookie_scan(ngx_str_t *value);
+static ngx_uint_t ngx_http_security_headers_cookie_is(u_char *name,
+    char *word, size_t len);
+
+
+ngx_conf_bitmask_t  ngx_http_security_headers_cookie_values[] = {
+    { ngx_string("off"),
+      NGX_HTTP_SECURITY_HEADERS_COOKIE_OFF },
+
+    { ngx_string("secure"),
+      NGX_HTTP_SECURITY_HEADERS_COOKIE_SECURE },
+
+    { ngx_string("httponly"),
+      NGX_HTTP_SECURITY_HEADERS_COOKIE_HTTPONLY },
+
+    { ngx_string("samesite=strict"),
+      NGX_HTTP_SECURITY_HEADERS_COOKIE_STRICT },
+
+    { ngx_string("samesite=lax"),
+      NGX_HTTP_SECURITY_HEADERS_COOKIE_LAX },
+
+    { ngx_string("samesite=none"),
+      NGX_HTTP_SECURITY_HEADERS_COOKIE_NONE },
+
+    { ngx_null_string, 0 }
+};
+
+static ngx_str_t  ngx_http_security_headers_cookie_secure =
+    ngx_string("; Secure");
+static ngx_str_t  ngx_http_security_headers_cookie_httponly =
+    ngx_string("; HttpOnly");
+
+static ngx_str_t  ngx_http_security_headers_cookie_samesite[] = {
+    ngx_string("; SameSite=Strict"),
+    ngx_string("; SameSite=Lax"),
+    ngx_string("; SameSite=None")
+};
+
+
+char *
+ngx_http_security_headers_cookie_flags(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_security_headers_loc_conf_t *slcf = conf;
+
+    char        *rv;
+    ngx_uint_t   samesite;
+
+    rv = ngx_conf_set_bitmask_slot(cf, cmd, conf);
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    if ((slcf->cookie_flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_OFF)
+        && (slcf->cookie_flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_FLAGS))
+    {
+        return "combines \"off\" with flags";
+    }
+
+    samesite = slcf->cookie_flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_SAMESITE;
+
+    if (samesite & (samesite - 1)) {
+        return "has more than one \"samesite\" value";
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/* adds the attributes of flags which the cookie lacks */
+
+ngx_int_t
+ngx_http_security_headers_cookie_harden(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t flags)
+{
+    u_char     *p, *data, *last;
+    size_t      len;
+    ngx_str_t  *samesite;
+
+    flags &= ~ngx_http_security_headers_cookie_scan(&h->value);
+
+    if (flags == 0) {
+        return NGX_OK;
+    }
+
+    /* "name=value;" ends with an empty attribute, which is dropped */
+
+    last = h->value.data + h->value.len;
+
+    while (last > h->value.data
+           && (last[-1] == ';' || last[-1] == ' ' || last[-1] == '\t'))
+    {
+        last--;
+    }
+
+    len = last - h->value.data;
+    samesite = NULL;
+
+    if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_SECURE) {
+        len += ngx_http_security_headers_cookie_secure.len;
+    }
+
+    if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_HTTPONLY) {
+        len += ngx_http_security_headers_cookie_httponly.len;
+    }
+
+    if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_STRICT) {
+        samesite = &ngx_http_security_headers_cookie_samesite[0];
+
+    } else if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_LAX) {
+        samesite = &ngx_http_security_headers_cookie_samesite[1];
+
+    } else if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_NONE) {
+        samesite = &ngx_http_security_headers_cookie_samesite[2];
+    }
+
+    if (samesite) {
+        len += samesite->len;
+    }
+
+    data = ngx_pnalloc(r->pool, len);
+    if (data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(data, h->value.data, last - h->value.data);
+
+    if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_SECURE) {
+        p = ngx_cpymem(p, ngx_http_security_headers_cookie_secure.data,
+                       ngx_http_security_headers_cookie_secure.len);
+    }
+
+    if (flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_HTTPONLY) {
+        p = ngx_cpymem(p, ngx_http_security_headers_cookie_httponly.data,
+                       ngx_http_security_headers_cookie_httponly.len);
+    }
+
+    if (samesite) {
+        ngx_memcpy(p, samesite->data, samesite->len);
+    }
+
+    h->value.len = len;
+    h->value.data = data;
+
+    return NGX_OK;
+}
+
+
+/*
+ * The flags of the attributes the cookie has: the attributes follow the
+ * first ";", and a SameSite attribute of any value counts for all of its
+ * flags
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_cookie_scan(ngx_str_t *value)
+{
+    u_char      *p, *last, *name;
+    ngx_uint_t   present;
+
+    present = 0;
+
+    p = value->data;
+    last = p + value->len;
+
+    for ( ;; ) {
+
+        p = ngx_strlchr(p, last, ';');
+        if (p == NULL) {
+            break;
+        }
+
+        do {
+            p++;
+        } while (p < last && (*p == ' ' || *p == '\t'));
+
+        name = p;
+
+        while (p < last && *p != ';' && *p != '=' && *p != ' ' && *p != '\t')
+        {
+            p++;
+        }
+
+        switch (p - name) {
+
+        case sizeof("secure") - 1:
+            if (ngx_http_security_headers_cookie_is(name, "secure",
+                                                    sizeof("secure") - 1))
+            {
+                present |= NGX_HTTP_SECURITY_HEADERS_COOKIE_SECURE;
+            }
+
+            break;
+
+        case sizeof("httponly") - 1:
+            if (ngx_http_security_headers_cookie_is(name, "httponly",
+                                                    sizeof("httponly") - 1))
+            {
+                present |= NGX_HTTP_SECURITY_HEADERS_COOKIE_HTTPONLY;
+
+            } else if (ngx_http_security_headers_cookie_is(name, "samesite",
+                                                   sizeof("samesite") - 1))
+            {
+                present |= NGX_HTTP_SECURITY_HEADERS_COOKIE_SAMESITE;
+            }
+
+            break;
+        }
+    }
+
+    return present;
+}
+
+
+/*
+ * Compares a name of up to 8 bytes with a lowercase word as one integer:
+ * setting bit 5 of each byte only equates the two cases of a letter
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_cookie_is(u_char *name, char *word, size_t len)
+{
+    uint64_t  a, b;
+
+    a = 0;
+    b = 0;
+
+    ngx_memcpy(&a, name, len);
+    ngx_memcpy(&b, word, len);
+
+    return (a | NGX_HTTP_SECURITY_HEADERS_COOKIE_CASE)
+           == (b | NGX_HTTP_SECURITY_HEADERS_COOKIE_CASE);
+}
@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_fetch_isolation refuses cross-site requests with the
+ * Sec-Fetch-* metadata of browsers, before they reach the content handler:
+ * a resource isolation policy.  Requests which are not cross-site, and
+ * requests without the metadata, as from older browsers and other clients,
+ * are let through.  Cross-site requests pass as top level navigations with
+ * GET or HEAD, and with the modes and destinations the location allows.
+ *
+ * The names of the modes and destinations are bits of one mask, which
+ * security_headers_fetch_allow sets.  At merge time they are compiled to a
+ * table of the destinations allowed per method class and mode, so
+ * a request costs a walk of its headers and one lookup.
+ *
+ * The handler runs in the preaccess phase, so that "satisfy any" cannot
+ * let another access module override it.
+ */
+
+
+#define NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(n)   ((uint32_t) 1 << (n))
+
+#define NGX_HTTP_SECURITY_HEADERS_DEST_EMBED     4
+#define NGX_HTTP_SECURITY_HEADERS_DEST_OBJECT    12
+#define NGX_HTTP_SECURITY_HEADERS_DEST_OTHER     24
+#define NGX_HTTP_SECURITY_HEADERS_DESTS          0x01fffffe
+
+#define NGX_HTTP_SECURITY_HEADERS_MODE_BASE      25
+#define NGX_HTTP_SECURITY_HEADERS_MODE_NAVIGATE  0
+#define NGX_HTTP_SECURITY_HEADERS_MODE_OTHER     5
+
+
+static ngx_int_t ngx_http_security_headers_fetch_handler(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_security_headers_fetch_value(ngx_str_t *value,
+    ngx_uint_t first, ngx_uint_t other);
+
+
+/* Sec-Fetch-Dest values, then Sec-Fetch-Mode values */
+
+ngx_conf_bitmask_t  ngx_http_security_headers_fetch_values[] = {
+    { ngx_string("audio"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(1) },
+    { ngx_string("audioworklet"),  NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(2) },
+    { ngx_string("document"),      NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(3) },
+    { ngx_string("embed"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(4) },
+    { ngx_string("empty"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(5) },
+    { ngx_string("font"),          NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(6) },
+    { ngx_string("frame"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(7) },
+    { ngx_string("iframe"),        NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(8) },
+    { ngx_string("image"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(9) },
+    { ngx_string("json"),          NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(10) },
+    { ngx_string("manifest"),      NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(11) },
+    { ngx_string("object"),        NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(12) },
+    { ngx_string("paintworklet"),  NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(13) },
+    { ngx_string("report"),        NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(14) },
+    { ngx_string("script"),        NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(15) },
+    { ngx_string("serviceworker"), NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(16) },
+    { ngx_string("sharedworker"),  NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(17) },
+    { ngx_string("style"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(18) },
+    { ngx_string("track"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(19) },
+    { ngx_string("video"),         NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(20) },
+    { ngx_string("webidentity"),   NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(21) },
+    { ngx_string("worker"),        NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(22) },
+    { ngx_string("xslt"),          NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(23) },
+
+    { ngx_string("navigate"),      NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(25) },
+    { ngx_string("same-origin"),   NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(26) },
+    { ngx_string("no-cors"),       NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(27) },
+    { ngx_string("cors"),          NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(28) },
+    { ngx_string("websocket"),     NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(29) },
+    { ngx_null_string, 0 }
+};
+
+
+ngx_int_t
+ngx_http_security_headers_fetch_init(ngx_conf_t *cf)
+{
+    ngx_http_handler_pt        *h;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_PREACCESS_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_security_headers_fetch_handler;
+
+    return NGX_OK;
+}
+
+
+/* The destinations allowed cross-site, per safe method and mode */
+
+void
+ngx_http_security_headers_fetch_compile(
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    uint32_t    mask;
+    ngx_uint_t  safe, mode;
+
+    for (safe = 0; safe < 2; safe++) {
+        for (mode = 0; mode < NGX_HTTP_SECURITY_HEADERS_FETCH_MODES; mode++) {
+
+            mask = conf->fetch_allow & NGX_HTTP_SECURITY_HEADERS_DESTS;
+
+            if (conf->fetch_allow
+                & NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(
+                      NGX_HTTP_SECURITY_HEADERS_MODE_BASE + mode))
+            {
+                mask = NGX_HTTP_SECURITY_HEADERS_DESTS;
+
+            } else if (safe && mode == NGX_HTTP_SECURITY_HEADERS_MODE_NAVIGATE) {
+
+                /* plugins load resources with navigations of their own */
+
+                mask = NGX_HTTP_SECURITY_HEADERS_DESTS
+                       & ~NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(
+                              NGX_HTTP_SECURITY_HEADERS_DEST_EMBED)
+                       & ~NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(
+                              NGX_HTTP_SECURITY_HEADERS_DEST_OBJECT);
+            }
+
+            conf->fetch_table[safe][mode] = mask;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_fetch_handler(ngx_http_request_t *r)
+{
+    u_char                                *name;
+    ngx_uint_t                             i, safe, mode, dest;
+    ngx_str_t                             *site, *mode_value, *dest_value;
+    ngx_list_part_t                       *part;
+    ngx_table_elt_t                       *h;
+    ngx_http_security_headers_loc_conf_t  *slcf;
+
+    static ngx_str_t  none = ngx_string("-");
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+
+    if (slcf->enable != 1
+        || slcf->fetch_isolation == NGX_HTTP_SECURITY_HEADERS_FETCH_OFF
+        || r != r->main)
+    {
+        return NGX_DECLINED;
+    }
+
+    site = NULL;
+    mode_value = &none;
+    dest_value = &none;
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        /* the three names have the same length */
+
+        if (h[i].key.len != sizeof("Sec-Fetch-Site") - 1
+            || ngx_strncasecmp(h[i].key.data, (u_char *) "Sec-Fetch-",
+                               sizeof("Sec-Fetch-") - 1)
+               != 0)
+        {
+            continue;
+        }
+
+        name = h[i].key.data + sizeof("Sec-Fetch-") - 1;
+
+        if (ngx_strncasecmp(name, (u_char *) "Site", 4) == 0) {
+            site = &h[i].value;
+
+        } else if (ngx_strncasecmp(name, (u_char *) "Mode", 4) == 0) {
+            mode_value = &h[i].value;
+
+        } else if (ngx_strncasecmp(name, (u_char *) "Dest", 4) == 0) {
+            dest_value = &h[i].value;
+        }
+    }
+
+    /* same-origin, same-site, none, or no metadata */
+
+    if (site == NULL
+        || site->len != sizeof("cross-site") - 1
+        || ngx_strncmp(site->data, "cross-site", sizeof("cross-site") - 1)
+           != 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    mode = ngx_http_security_headers_fetch_value(mode_value,
+                                       NGX_HTTP_SECURITY_HEADERS_MODE_BASE,
+                                       NGX_HTTP_SECURITY_HEADERS_MODE_BASE
+                                       + NGX_HTTP_SECURITY_HEADERS_MODE_OTHER)
+           - NGX_HTTP_SECURITY_HEADERS_MODE_BASE;
+
+    dest = ngx_http_security_headers_fetch_value(dest_value, 1,
+                                       NGX_HTTP_SECURITY_HEADERS_DEST_OTHER);
+
+    safe = (r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD)) ? 1 : 0;
+
+    if (slcf->fetch_table[safe][mode]
+        & NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(dest))
+    {
+        return NGX_DECLINED;
+    }
+
+    if (slcf->fetch_isolation == NGX_HTTP_SECURITY_HEADERS_FETCH_REPORT) {
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "security headers: cross-site request with mode "
+                      "\"%V\" and destination \"%V\" would be forbidden",
+                      mode_value, dest_value);
+        return NGX_DECLINED;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "security headers: cross-site request with mode \"%V\" "
+                  "and destination \"%V\" forbidden", mode_value, dest_value);
+
+    return NGX_HTTP_FORBIDDEN;
+}
+
+
+/* The bit of a mode or destination name from first on, or other */
+
+static ngx_uint_t
+ngx_http_security_headers_fetch_value(ngx_str_t *value, ngx_uint_t first,
+    ngx_uint_t other)
+{
+    ngx_uint_t           n;
+    ngx_conf_bitmask_t  *v;
+
+    for (v = ngx_http_security_headers_fetch_values; v->name.len; v++) {
+
+        if (v->name.len != value->len
+            || ngx_strncmp(v->name.data, value->data, value->len) != 0)
+        {
+            continue;
+        }
+
+        for (n = first; n < other; n++) {
+            if (v->mask == NGX_HTTP_SECURITY_HEADERS_FETCH_BIT(n)) {
+                return n;
+            }
+        }
+
+        break;
+    }
+
+    return other;
+}
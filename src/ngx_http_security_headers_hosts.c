@@ -0,0 +1,443 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_host_map gives the hosts of a server block policies of
+ * their own, from a file compiled by tools/security_headers_host_map.py.
+ * The file holds the distinct policies, as "name=value&..." strings of the
+ * policy values, and an open addressing hash table of the hostnames, with
+ * the index of their policy.  Wildcard names are kept with the leading "*"
+ * cut off, so "*.example.com" is found as ".example.com".
+ *
+ * The file is mapped read-only while the configuration is read, so the
+ * workers share one copy of it, and only its policies are parsed: a
+ * location gets a plan for each of them, shared with equal plans of other
+ * locations.  A request takes one probe for its host, and one for each
+ * wildcard suffix of the host until one is found.
+ *
+ * A mapping lives as long as its cycle.  A new file is picked up on reload,
+ * and has to be moved in place rather than written over.
+ */
+
+
+#define NGX_HTTP_SECURITY_HEADERS_HOST_VERSION  1
+
+
+/* the file, in little endian */
+
+typedef struct {
+    u_char                     magic[4];
+    uint32_t                   version;
+    uint32_t                   policies;
+    uint32_t                   buckets;
+    uint32_t                   hosts;
+    uint32_t                   reserved;
+} ngx_http_security_headers_host_header_t;
+
+typedef struct {
+    uint32_t                   offset;
+    uint32_t                   len;
+} ngx_http_security_headers_host_ref_t;
+
+/* an empty bucket has no name */
+typedef struct {
+    uint32_t                   hash;
+    uint32_t                   name;
+    uint16_t                   len;
+    uint16_t                   policy;
+} ngx_http_security_headers_host_bucket_t;
+
+
+static ngx_int_t ngx_http_security_headers_host_load(ngx_conf_t *cf,
+    ngx_http_security_headers_host_map_t *map);
+static void ngx_http_security_headers_host_unmap(void *data);
+static ngx_int_t ngx_http_security_headers_host_find(
+    ngx_http_security_headers_host_map_t *map, u_char *name, size_t len);
+
+
+char *
+ngx_http_security_headers_host_map(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char  *p = conf;
+
+    ngx_str_t                               *value, name;
+    ngx_uint_t                               i;
+    ngx_http_security_headers_host_map_t   **field, *map, **maps;
+    ngx_http_security_headers_main_conf_t   *smcf;
+
+    field = (ngx_http_security_headers_host_map_t **) (p + cmd->offset);
+
+    if (*field != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len == 3 && ngx_strncmp(value[1].data, "off", 3) == 0) {
+        *field = NULL;
+        return NGX_CONF_OK;
+    }
+
+    name = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    if (smcf->host_maps == NULL) {
+        smcf->host_maps = ngx_array_create(cf->pool, 1,
+                                   sizeof(ngx_http_security_headers_host_map_t *));
+        if (smcf->host_maps == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    /* a file is mapped once */
+
+    maps = smcf->host_maps->elts;
+
+    for (i = 0; i < smcf->host_maps->nelts; i++) {
+        if (maps[i]->name.len == name.len
+            && ngx_strncmp(maps[i]->name.data, name.data, name.len) == 0)
+        {
+            *field = maps[i];
+            return NGX_CONF_OK;
+        }
+    }
+
+    map = ngx_pcalloc(cf->pool, sizeof(ngx_http_security_headers_host_map_t));
+    if (map == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    map->name = name;
+
+    if (ngx_http_security_headers_host_load(cf, map) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    maps = ngx_array_push(smcf->host_maps);
+    if (maps == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *maps = map;
+    *field = map;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_host_load(ngx_conf_t *cf,
+    ngx_http_security_headers_host_map_t *map)
+{
+    u_char                                   *start;
+    size_t                                    size;
+    ngx_fd_t                                  fd;
+    ngx_uint_t                                i, npolicies, nbuckets;
+    ngx_file_info_t                           fi;
+    ngx_pool_cleanup_t                       *cln;
+    ngx_http_security_headers_policy_t        scratch;
+    ngx_http_security_headers_host_ref_t     *refs;
+    ngx_http_security_headers_host_header_t  *header;
+
+    fd = ngx_open_file(map->name.data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_open_file_n " \"%V\" failed", &map->name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_fd_info_n " \"%V\" failed", &map->name);
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (size < sizeof(ngx_http_security_headers_host_header_t)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" is not a host map", &map->name);
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    start = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    if (start == MAP_FAILED) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           "mmap(\"%V\") failed", &map->name);
+        (void) ngx_close_file(fd);
+        return NGX_ERROR;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_ALERT, cf, ngx_errno,
+                           ngx_close_file_n " \"%V\" failed", &map->name);
+    }
+
+    map->start = start;
+    map->size = size;
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        ngx_http_security_headers_host_unmap(map);
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_security_headers_host_unmap;
+    cln->data = map;
+
+    header = (ngx_http_security_headers_host_header_t *) start;
+
+    if (ngx_memcmp(header->magic, "SHHM", 4) != 0
+        || header->version != NGX_HTTP_SECURITY_HEADERS_HOST_VERSION)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" is not a host map of version %d",
+                           &map->name, NGX_HTTP_SECURITY_HEADERS_HOST_VERSION);
+        return NGX_ERROR;
+    }
+
+    npolicies = header->policies;
+    nbuckets = header->buckets;
+
+    size -= sizeof(ngx_http_security_headers_host_header_t);
+
+    if (nbuckets == 0 || (nbuckets & (nbuckets - 1))
+        || npolicies > size / sizeof(ngx_http_security_headers_host_ref_t)
+        || nbuckets > (size - npolicies
+                              * sizeof(ngx_http_security_headers_host_ref_t))
+                      / sizeof(ngx_http_security_headers_host_bucket_t))
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "host map \"%V\" is truncated", &map->name);
+        return NGX_ERROR;
+    }
+
+    map->policies = ngx_palloc(cf->pool, (npolicies ? npolicies : 1)
+                                         * sizeof(ngx_str_t));
+    if (map->policies == NULL) {
+        return NGX_ERROR;
+    }
+
+    refs = (ngx_http_security_headers_host_ref_t *) (header + 1);
+
+    for (i = 0; i < npolicies; i++) {
+
+        if (refs[i].offset > map->size
+            || refs[i].len > map->size - refs[i].offset)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "host map \"%V\" is truncated", &map->name);
+            return NGX_ERROR;
+        }
+
+        map->policies[i].len = refs[i].len;
+        map->policies[i].data = start + refs[i].offset;
+
+        ngx_memzero(&scratch, sizeof(ngx_http_security_headers_policy_t));
+
+        if (ngx_http_security_headers_policy_apply(&map->policies[i], &scratch)
+            != NGX_OK)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid policy \"%V\" in host map \"%V\"",
+                               &map->policies[i], &map->name);
+            return NGX_ERROR;
+        }
+    }
+
+    map->npolicies = npolicies;
+    map->buckets = (u_char *) (refs + npolicies);
+    map->mask = nbuckets - 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_security_headers_host_unmap(void *data)
+{
+    ngx_http_security_headers_host_map_t  *map = data;
+
+    if (munmap(map->start, map->size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "munmap(\"%V\") failed", &map->name);
+    }
+}
+
+
+/*
+ * Compiles the plans of a location for the policies of its host map, each
+ * one over the values of the location
+ */
+
+ngx_int_t
+ngx_http_security_headers_host_compile(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    ngx_uint_t                              i;
+    ngx_http_security_headers_host_map_t   *map;
+    ngx_http_security_headers_host_plan_t  *plans;
+    ngx_http_security_headers_loc_conf_t   *part;
+
+    map = conf->host_map;
+
+    plans = ngx_palloc(cf->pool, (map->npolicies ? map->npolicies : 1)
+                                 * sizeof(ngx_http_security_headers_host_plan_t));
+    if (plans == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < map->npolicies; i++) {
+
+        /* the shared parts refer to it while the configuration is read */
+
+        part = ngx_palloc(cf->temp_pool,
+                          sizeof(ngx_http_security_headers_loc_conf_t));
+        if (part == NULL) {
+            return NGX_ERROR;
+        }
+
+        *part = *conf;
+
+        /* checked when the file was loaded */
+
+        (void) ngx_http_security_headers_policy_apply(&map->policies[i],
+                                                      &part->policy);
+
+        if (ngx_http_security_headers_share(cf, part,
+                                           NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+#if (nginx_version >= 1029000)
+        if (ngx_http_security_headers_interim(cf, part) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        plans[i].interim = part->interim;
+        plans[i].interim_class = part->interim_class;
+#endif
+
+        plans[i].plan = part->plan;
+        plans[i].conditions = part->conditions;
+        plans[i].typed = part->typed;
+        plans[i].blocks = part->blocks;
+    }
+
+    conf->host_plans = plans;
+
+    return NGX_OK;
+}
+
+
+/* The plan of the policy of the request host, or NULL */
+
+ngx_http_security_headers_host_plan_t *
+ngx_http_security_headers_host_lookup(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf)
+{
+    u_char                                *p, *last;
+    ngx_int_t                              n;
+    ngx_str_t                             *host;
+    ngx_http_security_headers_host_map_t  *map;
+
+    map = slcf->host_map;
+    host = &r->headers_in.server;
+
+    if (host->len == 0) {
+        return NULL;
+    }
+
+    /* the host is lowercased when it is validated */
+
+    n = ngx_http_security_headers_host_find(map, host->data, host->len);
+
+    /* then the wildcards, the longest suffix first */
+
+    last = host->data + host->len;
+
+    for (p = host->data; n == NGX_DECLINED; p++) {
+        p = ngx_strlchr(p, last, '.');
+
+        if (p == NULL) {
+            return NULL;
+        }
+
+        n = ngx_http_security_headers_host_find(map, p, last - p);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: host map policy %i for \"%V\"",
+                   n, host);
+
+    return &slcf->host_plans[n];
+}
+
+
+/* 32-bit FNV-1a, as the compiler hashes the names */
+
+static ngx_int_t
+ngx_http_security_headers_host_find(ngx_http_security_headers_host_map_t *map,
+    u_char *name, size_t len)
+{
+    u_char                                   *data;
+    uint32_t                                  hash;
+    ngx_uint_t                                i, n;
+    ngx_http_security_headers_host_bucket_t  *bucket;
+
+    hash = 2166136261u;
+
+    for (i = 0; i < len; i++) {
+        hash ^= name[i];
+        hash *= 16777619u;
+    }
+
+    bucket = (ngx_http_security_headers_host_bucket_t *) map->buckets;
+
+    i = hash & map->mask;
+
+    for (n = 0; n <= map->mask; n++) {
+
+        if (bucket[i].len == 0) {
+            return NGX_DECLINED;
+        }
+
+        if (bucket[i].hash == hash && bucket[i].len == len) {
+            data = map->start + bucket[i].name;
+
+            /* a damaged entry is not found */
+
+            if (len <= map->size && bucket[i].name <= map->size - len
+                && ngx_memcmp(data, name, len) == 0
+                && bucket[i].policy < map->npolicies)
+            {
+                return bucket[i].policy;
+            }
+        }
+
+        i = (i + 1) & map->mask;
+    }
+
+    return NGX_DECLINED;
+}
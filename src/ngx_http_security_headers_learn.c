@@ -0,0 +1,1171 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_csp_learn sends HTML responses with a
+ * Content-Security-Policy which allows the inline scripts and styles seen
+ * in earlier responses of the same URI or location, by their SHA-256 hash
+ * sources, so the policy needs no 'unsafe-inline'.
+ *
+ * A body filter tokenizes the HTML as it passes, just enough to tell the
+ * raw text of <script> and <style> elements from comments, other tags and
+ * quoted attribute values.  The raw text is hashed where it lies in the
+ * buffers; only the bytes of an end tag split between two buffers are kept
+ * aside, so a request costs the same memory whatever the response size.
+ * When the response is complete, the hashes which are new to its key are
+ * added to the entry of the key in a shared memory zone, up to
+ * NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES of each type, dropping the oldest
+ * ones first.  The entry keeps the header value ready, so the header filter
+ * only looks it up and copies it.
+ *
+ * Entries are found in an rbtree by the hash of their key and kept in a
+ * queue by their last use; the least recently used ones are removed when
+ * the zone is full.  The request URI is up to the client, so the entries
+ * of a location are counted, by a hash of the server and location names,
+ * and a location which has NGX_HTTP_SECURITY_HEADERS_LEARN_URIS of them
+ * learns no new URIs until some are removed: random URIs do not push the
+ * entries of other locations out of the zone.
+ *
+ * With security_headers_csp_nonce, see _nonce.c, the same tokenizer finds
+ * the end of the name of each <script> and <style> start tag, and the
+ * filter cuts the buffer there to put a small buffer with the nonce
+ * attribute in between.  The body bytes are not copied.
+ */
+
+
+#if (NGX_OPENSSL)
+
+#include <openssl/evp.h>
+
+
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES  32
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST  32
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_URIS    256
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_SLOTS   1024
+
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_SCRIPT  0
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_STYLE   1
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES   2
+
+/* " 'sha256-" base64 "'" */
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_SOURCE                                \
+    (sizeof(" 'sha256-'") - 1                                                 \
+     + ngx_base64_encoded_length(NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST))
+
+
+/* the entries per hash of the server and location names */
+typedef struct {
+    ngx_rbtree_t               rbtree;
+    ngx_rbtree_node_t          sentinel;
+    ngx_queue_t                queue;
+    ngx_uint_t                 entries[NGX_HTTP_SECURITY_HEADERS_LEARN_SLOTS];
+} ngx_http_security_headers_learn_sh_t;
+
+
+/* the digests of each type, oldest first, and the value are after the key */
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_queue_t                queue;
+    ngx_uint_t                 slot;
+    ngx_uint_t                 n[NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES];
+    u_char                    *digests;
+    ngx_str_t                  value;
+    u_char                     data[1];
+} ngx_http_security_headers_learned_t;
+
+
+/* md is NULL when only the nonce is added */
+struct ngx_http_security_headers_learn_s {
+    ngx_str_t                  key;
+    ngx_uint_t                 slot;
+    EVP_MD_CTX                *md;
+
+    /* the nonce attribute, and the buffers which carry it */
+    ngx_str_t                  nonce;
+    ngx_uint_t                 spliced;
+    ngx_chain_t               *free;
+    ngx_chain_t               *busy;
+
+    ngx_uint_t                 state;
+    ngx_uint_t                 raw;
+    ngx_uint_t                 quote;
+    ngx_uint_t                 failed;
+    size_t                     len;
+
+    /* the tag name up to 7 bytes, or the bytes of a possible end tag */
+    ngx_uint_t                 m;
+    u_char                     name[8];
+    u_char                     pend[8];
+
+    ngx_uint_t                 n[NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES];
+    u_char                     digests[NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES]
+                                      [NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES]
+                                      [NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST];
+};
+
+
+typedef enum {
+    sw_text = 0,
+    sw_lt,
+    sw_bang,
+    sw_bang_dash,
+    sw_comment,
+    sw_comment_dash,
+    sw_comment_end,
+    sw_skip,
+    sw_name,
+    sw_attrs,
+    sw_quoted,
+    sw_raw
+} ngx_http_security_headers_learn_state_e;
+
+
+static ngx_int_t ngx_http_security_headers_learn_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_security_headers_learn_key(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf, ngx_str_t *key,
+    ngx_uint_t *slot);
+static void ngx_http_security_headers_learn_free(ngx_slab_pool_t *shpool,
+    ngx_http_security_headers_learn_sh_t *sh,
+    ngx_http_security_headers_learned_t *node);
+static void ngx_http_security_headers_learn_cleanup(void *data);
+static ngx_int_t ngx_http_security_headers_learn_body_filter(
+    ngx_http_request_t *r, ngx_chain_t *in);
+static ngx_int_t ngx_http_security_headers_learn_splice(ngx_http_request_t *r,
+    ngx_http_security_headers_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_security_headers_learn_cut(ngx_http_request_t *r,
+    ngx_http_security_headers_learn_t *learn, ngx_buf_t *b,
+    ngx_chain_t ***ll);
+static u_char *ngx_http_security_headers_learn_parse(
+    ngx_http_security_headers_learn_t *learn, u_char *p, u_char *last);
+static ngx_uint_t ngx_http_security_headers_learn_element(
+    ngx_http_security_headers_learn_t *learn);
+static void ngx_http_security_headers_learn_open(
+    ngx_http_security_headers_learn_t *learn);
+static void ngx_http_security_headers_learn_hash(
+    ngx_http_security_headers_learn_t *learn, u_char *p, size_t len);
+static void ngx_http_security_headers_learn_close(
+    ngx_http_security_headers_learn_t *learn);
+static void ngx_http_security_headers_learn_store(ngx_http_request_t *r,
+    ngx_http_security_headers_learn_t *learn);
+static ngx_uint_t ngx_http_security_headers_learn_merge(
+    ngx_http_security_headers_learned_t *node,
+    ngx_http_security_headers_learn_t *learn, u_char *digests,
+    ngx_uint_t *n);
+static u_char *ngx_http_security_headers_learn_value(u_char *p,
+    u_char *digests, ngx_uint_t *n);
+
+
+static ngx_http_output_body_filter_pt  ngx_http_next_body_filter;
+
+static ngx_str_t  ngx_http_security_headers_learn_zone_name =
+    ngx_string("security_headers_csp_learn");
+
+static ngx_str_t  ngx_http_security_headers_learn_ends[] = {
+    ngx_string("</script"),
+    ngx_string("</style")
+};
+
+static ngx_str_t  ngx_http_security_headers_learn_directives[] = {
+    ngx_string("; script-src 'self'"),
+    ngx_string("; style-src 'self'")
+};
+
+static ngx_str_t  ngx_http_security_headers_learn_prefix =
+    ngx_string("object-src 'none'; base-uri 'self'");
+
+static ngx_str_t  ngx_http_security_headers_learn_report =
+    ngx_string("; report-to " NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP);
+
+
+ngx_int_t
+ngx_http_security_headers_learn_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    ngx_http_security_headers_name_t  *name;
+
+    if (smcf->learn) {
+        if (smcf->learn_size < 8 * ngx_pagesize) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"security_headers_csp_learn_size\" must be "
+                               "at least %uz", 8 * ngx_pagesize);
+            return NGX_ERROR;
+        }
+
+        smcf->learn_zone = ngx_shared_memory_add(cf,
+                                    &ngx_http_security_headers_learn_zone_name,
+                                    smcf->learn_size,
+                                    &ngx_http_security_headers_module);
+        if (smcf->learn_zone == NULL) {
+            return NGX_ERROR;
+        }
+
+        smcf->learn_zone->init = ngx_http_security_headers_learn_init_zone;
+    }
+
+    name = &ngx_http_security_headers_managed[NGX_HTTP_SECURITY_HEADERS_CSP];
+
+    smcf->csp_entry.key = name->key;
+    smcf->csp_entry.lowcase_key = name->lowcase_key.data;
+    smcf->csp_entry.hash = ngx_hash_key(name->lowcase_key.data,
+                                        name->lowcase_key.len);
+    smcf->csp_entry.index = NGX_HTTP_SECURITY_HEADERS_CSP;
+
+    ngx_http_next_body_filter = ngx_http_top_body_filter;
+    ngx_http_top_body_filter = ngx_http_security_headers_learn_body_filter;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_learn_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data)
+{
+    ngx_slab_pool_t                       *shpool;
+    ngx_http_security_headers_learn_sh_t  *sh;
+
+    if (data) {
+        /* the same size, the learned hashes are kept */
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    sh = ngx_slab_calloc(shpool, sizeof(ngx_http_security_headers_learn_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_rbtree_init(&sh->rbtree, &sh->sentinel, ngx_str_rbtree_insert_value);
+    ngx_queue_init(&sh->queue);
+
+    /* a full zone is expected, the oldest entries make room */
+    shpool->log_nomem = 0;
+
+    shm_zone->data = sh;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Adds the learned policy of the key to a successful HTML response, and
+ * starts learning from its body
+ */
+
+ngx_int_t
+ngx_http_security_headers_learn_header(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_learn_t **learnp)
+{
+    u_char                                 *p;
+    uint32_t                                hash;
+    ngx_str_t                               key;
+    ngx_uint_t                              slot;
+    ngx_slab_pool_t                        *shpool;
+    ngx_pool_cleanup_t                     *cln;
+    ngx_http_security_headers_entry_t      *entry;
+    ngx_http_security_headers_learn_t      *learn;
+    ngx_http_security_headers_learned_t    *node;
+    ngx_http_security_headers_learn_sh_t   *sh;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    if (r != r->main || smcf->learn_zone == NULL
+        || r->headers_out.status != NGX_HTTP_OK)
+    {
+        return NGX_OK;
+    }
+
+    if (ngx_http_security_headers_learn_key(r, slcf, &key, &slot) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    shpool = (ngx_slab_pool_t *) smcf->learn_zone->shm.addr;
+    sh = smcf->learn_zone->data;
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    p = NULL;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    node = (ngx_http_security_headers_learned_t *)
+               ngx_str_rbtree_lookup(&sh->rbtree, &key, hash);
+
+    if (node) {
+        ngx_queue_remove(&node->queue);
+        ngx_queue_insert_head(&sh->queue, &node->queue);
+
+        p = ngx_pnalloc(r->pool, node->value.len
+                        + ngx_http_security_headers_learn_report.len);
+
+        if (p) {
+            entry = ngx_palloc(r->pool,
+                               sizeof(ngx_http_security_headers_entry_t));
+
+            if (entry) {
+                *entry = smcf->csp_entry;
+                entry->value.data = p;
+
+                p = ngx_cpymem(p, node->value.data, node->value.len);
+
+                if (slcf->report) {
+                    p = ngx_cpymem(p,
+                                   ngx_http_security_headers_learn_report.data,
+                                   ngx_http_security_headers_learn_report.len);
+                }
+
+                entry->value.len = p - entry->value.data;
+                entries[NGX_HTTP_SECURITY_HEADERS_CSP] = entry;
+
+            } else {
+                p = NULL;
+            }
+        }
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (node && p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: csp learned for \"%V\": %s",
+                   &key, node ? "found" : "none");
+
+    /* compressed bodies are not looked into */
+
+    if (r->header_only
+        || (r->headers_out.content_encoding
+            && r->headers_out.content_encoding->value.len))
+    {
+        return NGX_OK;
+    }
+
+    learn = ngx_http_security_headers_learn_create(r, NULL);
+    if (learn == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    learn->md = EVP_MD_CTX_new();
+    if (learn->md == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_http_security_headers_learn_cleanup;
+    cln->data = learn;
+
+    learn->key = key;
+    learn->slot = slot;
+
+    *learnp = learn;
+
+    return NGX_OK;
+}
+
+
+/* The body state of a response, with the nonce attribute to add, if any */
+
+ngx_http_security_headers_learn_t *
+ngx_http_security_headers_learn_create(ngx_http_request_t *r,
+    ngx_str_t *nonce)
+{
+    ngx_http_security_headers_learn_t  *learn;
+
+    learn = ngx_pcalloc(r->pool, sizeof(ngx_http_security_headers_learn_t));
+    if (learn == NULL) {
+        return NULL;
+    }
+
+    if (nonce) {
+        learn->nonce = *nonce;
+    }
+
+    /* sendfile would keep the body out of reach */
+    r->filter_need_in_memory = 1;
+
+    return learn;
+}
+
+
+/*
+ * The server name, then the URI or the location name, and the slot of the
+ * location its entries are counted in
+ */
+
+static ngx_int_t
+ngx_http_security_headers_learn_key(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf, ngx_str_t *key,
+    ngx_uint_t *slot)
+{
+    u_char                    *p;
+    uint32_t                   crc;
+    ngx_str_t                 *name;
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_crc32_init(crc);
+    ngx_crc32_update(&crc, cscf->server_name.data, cscf->server_name.len);
+    ngx_crc32_update(&crc, (u_char *) " ", 1);
+    ngx_crc32_update(&crc, clcf->name.data, clcf->name.len);
+    ngx_crc32_final(crc);
+
+    *slot = crc % NGX_HTTP_SECURITY_HEADERS_LEARN_SLOTS;
+
+    name = (slcf->csp_learn == NGX_HTTP_SECURITY_HEADERS_LEARN_URI)
+           ? &r->uri : &clcf->name;
+
+    key->len = cscf->server_name.len + 1 + name->len;
+
+    key->data = ngx_pnalloc(r->pool, key->len);
+    if (key->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(key->data, cscf->server_name.data, cscf->server_name.len);
+    *p++ = ' ';
+    ngx_memcpy(p, name->data, name->len);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_security_headers_learn_cleanup(void *data)
+{
+    ngx_http_security_headers_learn_t  *learn = data;
+
+    EVP_MD_CTX_free(learn->md);
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_learn_body_filter(ngx_http_request_t *r,
+    ngx_chain_t *in)
+{
+    ngx_buf_t                          *b;
+    ngx_chain_t                        *cl;
+    ngx_http_security_headers_ctx_t    *ctx;
+    ngx_http_security_headers_learn_t  *learn;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_security_headers_module);
+
+    if (ctx == NULL || ctx->learn == NULL) {
+        return ngx_http_next_body_filter(r, in);
+    }
+
+    learn = ctx->learn;
+
+    if (learn->nonce.len) {
+        return ngx_http_security_headers_learn_splice(r, ctx, in);
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        if (ngx_buf_in_memory(b)) {
+            ngx_http_security_headers_learn_parse(learn, b->pos, b->last);
+
+        } else if (ngx_buf_size(b)) {
+            learn->failed = 1;
+        }
+
+        if (learn->failed) {
+            ctx->learn = NULL;
+            break;
+        }
+
+        if (b->last_buf) {
+            ngx_http_security_headers_learn_store(r, learn);
+            ctx->learn = NULL;
+            break;
+        }
+    }
+
+    return ngx_http_next_body_filter(r, in);
+}
+
+
+/*
+ * Passes the body on with the nonce after the tag names.  An input buffer
+ * keeps the part after its last cut, so whoever owns it does not reuse it
+ * before the parts ahead of it are sent.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_learn_splice(ngx_http_request_t *r,
+    ngx_http_security_headers_ctx_t *ctx, ngx_chain_t *in)
+{
+    ngx_int_t                           rc;
+    ngx_buf_t                          *b;
+    ngx_chain_t                        *cl, *out, **ll;
+    ngx_http_security_headers_learn_t  *learn;
+
+    learn = ctx->learn;
+
+    out = NULL;
+    ll = &out;
+
+    for ( /* void */ ; in; in = in->next) {
+        b = in->buf;
+
+        if (ctx->learn) {
+            if (ngx_buf_in_memory(b)) {
+                if (ngx_http_security_headers_learn_cut(r, learn, b, &ll)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+            } else if (ngx_buf_size(b)) {
+                ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                              "security headers: csp nonce not added to "
+                              "a body out of memory");
+                ctx->learn = NULL;
+            }
+
+            if (b->last_buf) {
+                ctx->learn = NULL;
+            }
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = b;
+        *ll = cl;
+        ll = &cl->next;
+    }
+
+    *ll = NULL;
+
+    rc = ngx_http_next_body_filter(r, out);
+
+    ngx_chain_update_chains(r->pool, &learn->free, &learn->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_security_headers_module);
+
+    return rc;
+}
+
+
+/* Moves the parts of a buffer ahead of each nonce to the output */
+
+static ngx_int_t
+ngx_http_security_headers_learn_cut(ngx_http_request_t *r,
+    ngx_http_security_headers_learn_t *learn, ngx_buf_t *b, ngx_chain_t ***ll)
+{
+    u_char       *p;
+    ngx_buf_t    *part;
+    ngx_chain_t  *cl;
+
+    for ( ;; ) {
+        p = ngx_http_security_headers_learn_parse(learn, b->pos, b->last);
+
+        if (p == b->last) {
+            return NGX_OK;
+        }
+
+        if (p != b->pos) {
+            cl = ngx_chain_get_free_buf(r->pool, &learn->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            part = cl->buf;
+            ngx_memzero(part, sizeof(ngx_buf_t));
+
+            part->tag = (ngx_buf_tag_t) &ngx_http_security_headers_module;
+            part->memory = 1;
+            part->pos = b->pos;
+            part->last = p;
+
+            **ll = cl;
+            *ll = &cl->next;
+
+            if (b->in_file) {
+                b->file_pos += p - b->pos;
+            }
+
+            b->pos = p;
+        }
+
+        cl = ngx_chain_get_free_buf(r->pool, &learn->free);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        part = cl->buf;
+        ngx_memzero(part, sizeof(ngx_buf_t));
+
+        part->tag = (ngx_buf_tag_t) &ngx_http_security_headers_module;
+        part->memory = 1;
+        part->pos = learn->nonce.data;
+        part->last = learn->nonce.data + learn->nonce.len;
+
+        **ll = cl;
+        *ll = &cl->next;
+    }
+}
+
+
+/*
+ * A small HTML tokenizer.  Quotes are honoured anywhere in a tag, which is
+ * good enough for the attribute values; the raw text of an element ends
+ * with its end tag in any case, followed by a space, "/" or ">".
+ *
+ * Returns where the nonce goes, before the byte after a tag name, or last;
+ * the next call from there goes on.
+ */
+
+static u_char *
+ngx_http_security_headers_learn_parse(ngx_http_security_headers_learn_t *learn,
+    u_char *p, u_char *last)
+{
+    u_char     ch, c, *start;
+    ngx_str_t  *end;
+
+    start = p;
+
+    for ( /* void */ ; p < last; p++) {
+        ch = *p;
+
+        switch (learn->state) {
+
+        case sw_text:
+            if (ch == '<') {
+                learn->state = sw_lt;
+            }
+            break;
+
+        case sw_lt:
+            c = (u_char) (ch | 0x20);
+
+            if (c >= 'a' && c <= 'z') {
+                learn->name[0] = c;
+                learn->m = 1;
+                learn->state = sw_name;
+                break;
+            }
+
+            switch (ch) {
+            case '<':
+                break;
+            case '!':
+                learn->state = sw_bang;
+                break;
+            case '/':
+            case '?':
+                learn->state = sw_skip;
+                break;
+            default:
+                learn->state = sw_text;
+            }
+            break;
+
+        case sw_bang:
+            learn->state = (ch == '-') ? sw_bang_dash
+                                       : (ch == '>') ? sw_text : sw_skip;
+            break;
+
+        case sw_bang_dash:
+            learn->state = (ch == '-') ? sw_comment
+                                       : (ch == '>') ? sw_text : sw_skip;
+            break;
+
+        case sw_comment:
+            if (ch == '-') {
+                learn->state = sw_comment_dash;
+            }
+            break;
+
+        case sw_comment_dash:
+            learn->state = (ch == '-') ? sw_comment_end : sw_comment;
+            break;
+
+        case sw_comment_end:
+            if (ch == '>') {
+                learn->state = sw_text;
+
+            } else if (ch != '-') {
+                learn->state = sw_comment;
+            }
+            break;
+
+        case sw_skip:
+            if (ch == '>') {
+                learn->state = sw_text;
+            }
+            break;
+
+        case sw_name:
+            switch (ch) {
+            case ' ': case '\t': case '\r': case '\n': case '\f': case '/':
+            case '>':
+                if (learn->nonce.len && !learn->spliced
+                    && ngx_http_security_headers_learn_element(learn)
+                       != NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES)
+                {
+                    learn->spliced = 1;
+                    return p;
+                }
+
+                learn->spliced = 0;
+
+                if (ch == '>') {
+                    ngx_http_security_headers_learn_open(learn);
+                    start = p + 1;
+
+                } else {
+                    learn->state = sw_attrs;
+                }
+                break;
+
+            default:
+                if (learn->m < sizeof(learn->name)) {
+                    learn->name[learn->m] = (ch >= 'A' && ch <= 'Z')
+                                            ? (u_char) (ch | 0x20) : ch;
+                }
+
+                learn->m++;
+            }
+            break;
+
+        case sw_attrs:
+            if (ch == '"' || ch == '\'') {
+                learn->quote = ch;
+                learn->state = sw_quoted;
+
+            } else if (ch == '>') {
+                ngx_http_security_headers_learn_open(learn);
+                start = p + 1;
+            }
+            break;
+
+        case sw_quoted:
+            if (ch == learn->quote) {
+                learn->state = sw_attrs;
+            }
+            break;
+
+        case sw_raw:
+            end = &ngx_http_security_headers_learn_ends[learn->raw];
+
+            if (learn->m == 0) {
+                if (ch == '<') {
+                    ngx_http_security_headers_learn_hash(learn, start,
+                                                         p - start);
+                    learn->pend[0] = ch;
+                    learn->m = 1;
+                }
+                break;
+            }
+
+            if (learn->m < end->len) {
+                c = (ch >= 'A' && ch <= 'Z') ? (u_char) (ch | 0x20) : ch;
+
+                if (c == end->data[learn->m]) {
+                    learn->pend[learn->m++] = ch;
+                    break;
+                }
+
+            } else if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n'
+                       || ch == '\f' || ch == '/' || ch == '>')
+            {
+                ngx_http_security_headers_learn_close(learn);
+                learn->state = (ch == '>') ? sw_text : sw_skip;
+                break;
+            }
+
+            /* not the end tag, the bytes kept aside are raw text */
+
+            ngx_http_security_headers_learn_hash(learn, learn->pend, learn->m);
+            learn->m = 0;
+            start = p;
+
+            if (ch == '<') {
+                learn->pend[0] = ch;
+                learn->m = 1;
+                start = p + 1;
+            }
+            break;
+        }
+    }
+
+    if (learn->state == sw_raw && learn->m == 0) {
+        ngx_http_security_headers_learn_hash(learn, start, last - start);
+    }
+
+    return last;
+}
+
+
+/* The type of the element of the tag name, or none */
+
+static ngx_uint_t
+ngx_http_security_headers_learn_element(
+    ngx_http_security_headers_learn_t *learn)
+{
+    if (learn->m == 6 && ngx_strncmp(learn->name, "script", 6) == 0) {
+        return NGX_HTTP_SECURITY_HEADERS_LEARN_SCRIPT;
+    }
+
+    if (learn->m == 5 && ngx_strncmp(learn->name, "style", 5) == 0) {
+        return NGX_HTTP_SECURITY_HEADERS_LEARN_STYLE;
+    }
+
+    return NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES;
+}
+
+
+static void
+ngx_http_security_headers_learn_open(ngx_http_security_headers_learn_t *learn)
+{
+    learn->state = sw_text;
+    learn->raw = ngx_http_security_headers_learn_element(learn);
+
+    if (learn->raw == NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES) {
+        return;
+    }
+
+    if (learn->md && EVP_DigestInit_ex(learn->md, EVP_sha256(), NULL) != 1) {
+        learn->failed = 1;
+        return;
+    }
+
+    learn->state = sw_raw;
+    learn->len = 0;
+    learn->m = 0;
+}
+
+
+static void
+ngx_http_security_headers_learn_hash(ngx_http_security_headers_learn_t *learn,
+    u_char *p, size_t len)
+{
+    if (len == 0 || learn->md == NULL) {
+        return;
+    }
+
+    if (EVP_DigestUpdate(learn->md, p, len) != 1) {
+        learn->failed = 1;
+    }
+
+    learn->len += len;
+}
+
+
+/* an element with src has no raw text, it needs no hash */
+
+static void
+ngx_http_security_headers_learn_close(ngx_http_security_headers_learn_t *learn)
+{
+    u_char      *digest;
+    ngx_uint_t   i, n;
+
+    u_char  md[EVP_MAX_MD_SIZE];
+
+    learn->m = 0;
+
+    if (learn->len == 0 || learn->md == NULL) {
+        return;
+    }
+
+    if (EVP_DigestFinal_ex(learn->md, md, NULL) != 1) {
+        learn->failed = 1;
+        return;
+    }
+
+    n = learn->n[learn->raw];
+
+    for (i = 0; i < n; i++) {
+        digest = learn->digests[learn->raw][i];
+
+        if (ngx_memcmp(digest, md, NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST)
+            == 0)
+        {
+            return;
+        }
+    }
+
+    if (n == NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES) {
+        /* more inline elements than a policy would list */
+        learn->failed = 1;
+        return;
+    }
+
+    ngx_memcpy(learn->digests[learn->raw][n], md,
+               NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST);
+    learn->n[learn->raw]++;
+}
+
+
+static void
+ngx_http_security_headers_learn_store(ngx_http_request_t *r,
+    ngx_http_security_headers_learn_t *learn)
+{
+    u_char                                 *p, *value, *digests;
+    size_t                                  size, len;
+    uint32_t                                hash;
+    ngx_uint_t                              n[NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES];
+    ngx_queue_t                            *q;
+    ngx_slab_pool_t                        *shpool;
+    ngx_http_security_headers_learned_t    *node, *old;
+    ngx_http_security_headers_learn_sh_t   *sh;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    if (learn->state == sw_raw) {
+        /* the document ends inside an element */
+        return;
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    len = NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES
+          * NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES
+          * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST;
+
+    digests = ngx_palloc(r->pool, len);
+    value = ngx_pnalloc(r->pool, ngx_http_security_headers_learn_prefix.len
+                        + ngx_http_security_headers_learn_directives[0].len
+                        + ngx_http_security_headers_learn_directives[1].len
+                        + NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES
+                          * NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES
+                          * NGX_HTTP_SECURITY_HEADERS_LEARN_SOURCE);
+
+    if (digests == NULL || value == NULL) {
+        return;
+    }
+
+    shpool = (ngx_slab_pool_t *) smcf->learn_zone->shm.addr;
+    sh = smcf->learn_zone->data;
+
+    hash = ngx_crc32_short(learn->key.data, learn->key.len);
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    old = (ngx_http_security_headers_learned_t *)
+              ngx_str_rbtree_lookup(&sh->rbtree, &learn->key, hash);
+
+    if (!ngx_http_security_headers_learn_merge(old, learn, digests, n)) {
+        /* nothing new, the usual case */
+        ngx_shmtx_unlock(&shpool->mutex);
+        return;
+    }
+
+    if (old == NULL
+        && sh->entries[learn->slot] >= NGX_HTTP_SECURITY_HEADERS_LEARN_URIS)
+    {
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "security headers: csp learn entries of the location "
+                       "are used up, \"%V\" is not learned", &learn->key);
+        return;
+    }
+
+    len = ngx_http_security_headers_learn_value(value, digests, n) - value;
+
+    size = offsetof(ngx_http_security_headers_learned_t, data)
+           + learn->key.len
+           + (n[0] + n[1]) * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST + len;
+
+    if (old) {
+        ngx_http_security_headers_learn_free(shpool, sh, old);
+    }
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(shpool, size);
+
+        if (node || ngx_queue_empty(&sh->queue)) {
+            break;
+        }
+
+        /* the least recently used entry makes room */
+
+        q = ngx_queue_last(&sh->queue);
+        old = ngx_queue_data(q, ngx_http_security_headers_learned_t, queue);
+
+        ngx_http_security_headers_learn_free(shpool, sh, old);
+    }
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&shpool->mutex);
+
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "security headers: csp learn zone is too small "
+                      "for \"%V\"", &learn->key);
+        return;
+    }
+
+    p = node->data;
+
+    node->slot = learn->slot;
+    sh->entries[node->slot]++;
+
+    node->sn.node.key = hash;
+    node->sn.str.len = learn->key.len;
+    node->sn.str.data = p;
+    p = ngx_cpymem(p, learn->key.data, learn->key.len);
+
+    node->n[0] = n[0];
+    node->n[1] = n[1];
+    node->digests = p;
+    p = ngx_cpymem(p, digests,
+                   (n[0] + n[1]) * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST);
+
+    node->value.len = len;
+    node->value.data = p;
+    ngx_memcpy(p, value, len);
+
+    ngx_rbtree_insert(&sh->rbtree, &node->sn.node);
+    ngx_queue_insert_head(&sh->queue, &node->queue);
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: csp learned for \"%V\": %ui script, "
+                   "%ui style hashes", &learn->key, n[0], n[1]);
+}
+
+
+/* the entry is removed with the zone locked */
+
+static void
+ngx_http_security_headers_learn_free(ngx_slab_pool_t *shpool,
+    ngx_http_security_headers_learn_sh_t *sh,
+    ngx_http_security_headers_learned_t *node)
+{
+    sh->entries[node->slot]--;
+
+    ngx_queue_remove(&node->queue);
+    ngx_rbtree_delete(&sh->rbtree, &node->sn.node);
+    ngx_slab_free_locked(shpool, node);
+}
+
+
+/*
+ * Puts the digests of the entry and the new ones of the response together,
+ * the newest last, and tells if there were new ones
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_learn_merge(ngx_http_security_headers_learned_t *node,
+    ngx_http_security_headers_learn_t *learn, u_char *digests, ngx_uint_t *n)
+{
+    u_char      *known, *p;
+    ngx_uint_t   t, i, j, k, m, skip, added;
+
+    u_char  fresh[NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES]
+                 [NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST];
+
+    p = digests;
+    known = node ? node->digests : NULL;
+    added = (node == NULL);
+
+    for (t = 0; t < NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES; t++) {
+
+        k = node ? node->n[t] : 0;
+        m = 0;
+
+        for (i = 0; i < learn->n[t]; i++) {
+
+            for (j = 0; j < k; j++) {
+                if (ngx_memcmp(learn->digests[t][i],
+                               known + j * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST,
+                               NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST)
+                    == 0)
+                {
+                    break;
+                }
+            }
+
+            if (j == k) {
+                ngx_memcpy(fresh[m++], learn->digests[t][i],
+                           NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST);
+            }
+        }
+
+        if (m) {
+            added = 1;
+        }
+
+        skip = (k + m > NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES)
+               ? k + m - NGX_HTTP_SECURITY_HEADERS_LEARN_HASHES : 0;
+
+        if (k > skip) {
+            p = ngx_cpymem(p,
+                           known + skip * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST,
+                           (k - skip) * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST);
+        }
+
+        p = ngx_cpymem(p, fresh, m * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST);
+
+        n[t] = k - skip + m;
+
+        if (known) {
+            known += k * NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST;
+        }
+    }
+
+    return added;
+}
+
+
+static u_char *
+ngx_http_security_headers_learn_value(u_char *p, u_char *digests,
+    ngx_uint_t *n)
+{
+    ngx_str_t   src, dst;
+    ngx_uint_t  t, i;
+
+    p = ngx_cpymem(p, ngx_http_security_headers_learn_prefix.data,
+                   ngx_http_security_headers_learn_prefix.len);
+
+    src.len = NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST;
+    src.data = digests;
+
+    for (t = 0; t < NGX_HTTP_SECURITY_HEADERS_LEARN_TYPES; t++) {
+        p = ngx_cpymem(p, ngx_http_security_headers_learn_directives[t].data,
+                       ngx_http_security_headers_learn_directives[t].len);
+
+        for (i = 0; i < n[t]; i++) {
+            p = ngx_cpymem(p, " 'sha256-", sizeof(" 'sha256-") - 1);
+
+            dst.data = p;
+            ngx_encode_base64(&dst, &src);
+            p += dst.len;
+
+            *p++ = '\'';
+
+            src.data += NGX_HTTP_SECURITY_HEADERS_LEARN_DIGEST;
+        }
+    }
+
+    return p;
+}
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * Exact header name matching.  The scalar matcher lowercases the name and
+ * looks it up in the names hash.  On x86, the names up to
+ * NGX_HTTP_SECURITY_HEADERS_ROW bytes are also packed lowercased into zero
+ * padded rows grouped by length; a response header name is loaded into a
+ * vector, folded to lowercase and compared against the rows of its length
+ * only, 16 bytes per SSE2 compare or 32 bytes per AVX2 one.  The matcher is
+ * picked once, by the features of the CPU nginx starts on.
+ */
+
+
+#if (defined __SSE2__ || defined _M_X64                                      \
+     || (defined _M_IX86_FP && _M_IX86_FP >= 2))
+#define NGX_HTTP_SECURITY_HEADERS_SSE2  1
+#include <emmintrin.h>
+#endif
+
+#if (NGX_HTTP_SECURITY_HEADERS_SSE2 && defined __GNUC__                      \
+     && (defined __x86_64__ || defined __i386__))
+#define NGX_HTTP_SECURITY_HEADERS_AVX2  1
+#include <immintrin.h>
+#endif
+
+
+static ngx_http_security_headers_action_t *
+    ngx_http_security_headers_match_scalar(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf);
+
+#if (NGX_HTTP_SECURITY_HEADERS_SSE2)
+static u_char *ngx_http_security_headers_match_load(u_char *name, size_t len,
+    u_char *tmp);
+static ngx_http_security_headers_action_t *
+    ngx_http_security_headers_match_sse2(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf);
+#endif
+
+#if (NGX_HTTP_SECURITY_HEADERS_AVX2)
+static ngx_http_security_headers_action_t *
+    ngx_http_security_headers_match_avx2(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf);
+#endif
+
+
+ngx_http_security_headers_match_pt  ngx_http_security_headers_match =
+    ngx_http_security_headers_match_scalar;
+
+
+#if (NGX_HTTP_SECURITY_HEADERS_SSE2)
+
+/* loaded at 32 - len, keeps the first len bytes of a row */
+
+static const u_char  ngx_http_security_headers_row_mask[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#endif
+
+
+/*
+ * Packs the exact names of the table, they are lowercased already.  Rows
+ * are sorted by length with a counting sort, row_start[len] is the first
+ * row of a length and row_start[len + 1] is past its last one.
+ */
+
+ngx_int_t
+ngx_http_security_headers_match_pack(ngx_conf_t *cf,
+    ngx_http_security_headers_names_t *names, ngx_hash_key_t *keys,
+    ngx_uint_t n)
+{
+    ngx_uint_t   i, len, row, rows;
+    uint16_t     next[NGX_HTTP_SECURITY_HEADERS_ROW + 2];
+
+    ngx_memzero(names->row_start, sizeof(names->row_start));
+
+    rows = 0;
+
+    for (i = 0; i < n; i++) {
+        if (keys[i].key.len <= NGX_HTTP_SECURITY_HEADERS_ROW) {
+            names->row_start[keys[i].key.len + 1]++;
+            rows++;
+        }
+    }
+
+    for (len = 1; len < NGX_HTTP_SECURITY_HEADERS_ROW + 2; len++) {
+        names->row_start[len] += names->row_start[len - 1];
+    }
+
+    if (rows == 0) {
+        return NGX_OK;
+    }
+
+    names->rows = ngx_pcalloc(cf->pool, rows * NGX_HTTP_SECURITY_HEADERS_ROW);
+    if (names->rows == NULL) {
+        return NGX_ERROR;
+    }
+
+    names->row_actions = ngx_palloc(cf->pool,
+                         rows * sizeof(ngx_http_security_headers_action_t *));
+    if (names->row_actions == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(next, names->row_start, sizeof(next));
+
+    for (i = 0; i < n; i++) {
+        len = keys[i].key.len;
+
+        if (len > NGX_HTTP_SECURITY_HEADERS_ROW) {
+            continue;
+        }
+
+        row = next[len]++;
+
+        ngx_memcpy(names->rows + row * NGX_HTTP_SECURITY_HEADERS_ROW,
+                   keys[i].key.data, len);
+        names->row_actions[row] = keys[i].value;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_security_headers_match_init(ngx_log_t *log)
+{
+    char  *matcher;
+
+    matcher = "scalar";
+
+#if (NGX_HTTP_SECURITY_HEADERS_SSE2)
+    ngx_http_security_headers_match = ngx_http_security_headers_match_sse2;
+    matcher = "sse2";
+#endif
+
+#if (NGX_HTTP_SECURITY_HEADERS_AVX2)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        ngx_http_security_headers_match = ngx_http_security_headers_match_avx2;
+        matcher = "avx2";
+    }
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "security headers: %s name matcher", matcher);
+}
+
+
+static ngx_http_security_headers_action_t *
+ngx_http_security_headers_match_scalar(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf)
+{
+    ngx_uint_t  key;
+
+    key = ngx_hash_strlow(buf, name, len);
+
+    return ngx_hash_find(&names->hash, key, buf, len);
+}
+
+
+#if (NGX_HTTP_SECURITY_HEADERS_SSE2)
+
+/*
+ * Header names are not padded, a row is read from the name itself unless
+ * it crosses into the next page, which may be unmapped.
+ */
+
+static u_char *
+ngx_http_security_headers_match_load(u_char *name, size_t len, u_char *tmp)
+{
+    if (((uintptr_t) name & 4095) <= 4096 - NGX_HTTP_SECURITY_HEADERS_ROW) {
+        return name;
+    }
+
+    ngx_memcpy(tmp, name, len);
+
+    return tmp;
+}
+
+
+static ngx_http_security_headers_action_t *
+ngx_http_security_headers_match_sse2(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf)
+{
+    u_char      *p, *row, *mask;
+    __m128i      lo, hi, up, a, z, bit;
+    ngx_uint_t   i, last;
+
+    u_char  tmp[NGX_HTTP_SECURITY_HEADERS_ROW];
+
+    if (len > NGX_HTTP_SECURITY_HEADERS_ROW) {
+        return ngx_http_security_headers_match_scalar(names, name, len, buf);
+    }
+
+    p = ngx_http_security_headers_match_load(name, len, tmp);
+    mask = (u_char *) ngx_http_security_headers_row_mask
+           + NGX_HTTP_SECURITY_HEADERS_ROW - len;
+
+    a = _mm_set1_epi8('A' - 1);
+    z = _mm_set1_epi8('Z' + 1);
+    bit = _mm_set1_epi8(0x20);
+
+    lo = _mm_and_si128(_mm_loadu_si128((__m128i *) p),
+                       _mm_loadu_si128((__m128i *) mask));
+    up = _mm_and_si128(_mm_cmpgt_epi8(lo, a), _mm_cmplt_epi8(lo, z));
+    lo = _mm_or_si128(lo, _mm_and_si128(up, bit));
+
+    hi = _mm_and_si128(_mm_loadu_si128((__m128i *) (p + 16)),
+                       _mm_loadu_si128((__m128i *) (mask + 16)));
+    up = _mm_and_si128(_mm_cmpgt_epi8(hi, a), _mm_cmplt_epi8(hi, z));
+    hi = _mm_or_si128(hi, _mm_and_si128(up, bit));
+
+    /* the prefixes are probed on the lowercased bytes */
+
+    _mm_storeu_si128((__m128i *) buf, lo);
+    _mm_storeu_si128((__m128i *) (buf + 16), hi);
+
+    last = names->row_start[len + 1];
+
+    for (i = names->row_start[len]; i < last; i++) {
+        row = names->rows + i * NGX_HTTP_SECURITY_HEADERS_ROW;
+
+        if (_mm_movemask_epi8(
+                _mm_and_si128(
+                    _mm_cmpeq_epi8(lo, _mm_loadu_si128((__m128i *) row)),
+                    _mm_cmpeq_epi8(hi,
+                                   _mm_loadu_si128((__m128i *) (row + 16)))))
+            == 0xffff)
+        {
+            return names->row_actions[i];
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+#if (NGX_HTTP_SECURITY_HEADERS_AVX2)
+
+__attribute__((target("avx2")))
+static ngx_http_security_headers_action_t *
+ngx_http_security_headers_match_avx2(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf)
+{
+    u_char      *p, *row;
+    __m256i      v, up;
+    ngx_uint_t   i, last;
+
+    u_char  tmp[NGX_HTTP_SECURITY_HEADERS_ROW];
+
+    if (len > NGX_HTTP_SECURITY_HEADERS_ROW) {
+        return ngx_http_security_headers_match_scalar(names, name, len, buf);
+    }
+
+    p = ngx_http_security_headers_match_load(name, len, tmp);
+
+    v = _mm256_and_si256(_mm256_loadu_si256((__m256i *) p),
+                         _mm256_loadu_si256((__m256i *)
+                             (ngx_http_security_headers_row_mask
+                              + NGX_HTTP_SECURITY_HEADERS_ROW - len)));
+
+    up = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    v = _mm256_or_si256(v, _mm256_and_si256(up, _mm256_set1_epi8(0x20)));
+
+    _mm256_storeu_si256((__m256i *) buf, v);
+
+    last = names->row_start[len + 1];
+
+    for (i = names->row_start[len]; i < last; i++) {
+        row = names->rows + i * NGX_HTTP_SECURITY_HEADERS_ROW;
+
+        if ((uint32_t) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, _mm256_loadu_si256((__m256i *) row)))
+            == 0xffffffff)
+        {
+            return names->row_actions[i];
+        }
+    }
+
+    return NULL;
+}
+
+#endif
@@ -6,61 +6,67 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
-#include <ngx_string.h>
-
-#define NGX_HTTP_SECURITY_HEADER_OMIT  0
-
-#define NGX_HTTP_XSS_HEADER_OFF        1
-#define NGX_HTTP_XSS_HEADER_ON         2
-#define NGX_HTTP_XSS_HEADER_BLOCK      3
-#define NGX_HTTP_XSS_HEADER_UNSET      4  /* actively remove header */
-
-#define NGX_HTTP_FO_HEADER_SAME        1
-#define NGX_HTTP_FO_HEADER_DENY        2
-
-/* The Referrer Policy header */
-#define NGX_HTTP_RP_HEADER_NO                        1
-#define NGX_HTTP_RP_HEADER_DOWNGRADE                 2
-#define NGX_HTTP_RP_HEADER_SAME_ORIGIN               3
-#define NGX_HTTP_RP_HEADER_ORIGIN                    4
-#define NGX_HTTP_RP_HEADER_STRICT_ORIGIN             5
-#define NGX_HTTP_RP_HEADER_ORIGIN_WHEN_CROSS         6
-#define NGX_HTTP_RP_HEADER_STRICT_ORIG_WHEN_CROSS    7
-#define NGX_HTTP_RP_HEADER_UNSAFE_URL                8
-
-/* Cross-Origin-Resource-Policy */
-#define NGX_HTTP_CORP_HEADER_SAME_SITE      1
-#define NGX_HTTP_CORP_HEADER_SAME_ORIGIN    2
-#define NGX_HTTP_CORP_HEADER_CROSS_ORIGIN   3
-
-/* Cross-Origin-Opener-Policy */
-#define NGX_HTTP_COOP_HEADER_SAME_ORIGIN              1
-#define NGX_HTTP_COOP_HEADER_SAME_ORIGIN_ALLOW_POPUPS 2
-#define NGX_HTTP_COOP_HEADER_UNSAFE_NONE              3
-
-/* Cross-Origin-Embedder-Policy */
-#define NGX_HTTP_COEP_HEADER_REQUIRE_CORP    1
-#define NGX_HTTP_COEP_HEADER_CREDENTIALLESS  2
-#define NGX_HTTP_COEP_HEADER_UNSAFE_NONE     3
-
-typedef struct {
-    ngx_flag_t                 enable;
-    ngx_flag_t                 hide_server_tokens;
-    ngx_flag_t                 hsts_preload;
-
-    ngx_uint_t                 xss;
-    ngx_uint_t                 fo;
-    ngx_uint_t                 rp;
-    ngx_uint_t                 corp;
-    ngx_uint_t                 coop;
-    ngx_uint_t                 coep;
-
-    ngx_hash_t                 text_types;
-    ngx_array_t                *text_types_keys;
-
-} ngx_http_security_headers_loc_conf_t;
-
-static ngx_str_t empty_val = ngx_string("");
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * USDT probes of the "security_headers" provider, with sys/sdt.h found by
+ * the config script.  A probe is a nop instruction until a tracer attaches;
+ * the arguments which cost more than a load, the clock and the header
+ * count, are only computed while the semaphore of the probe is set.
+ * tools/ has bpftrace scripts using them.
+ */
+
+#if (NGX_HAVE_SDT)
+
+#define _SDT_HAS_SEMAPHORES  1
+#include <sys/sdt.h>
+
+#define NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(name)                             \
+    __extension__ volatile unsigned short security_headers_##name##_semaphore \
+        __attribute__ ((unused)) __attribute__ ((section (".probes")))
+
+NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(filter_entry);
+NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(filter_exit);
+NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(header_strip);
+NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(header_replace);
+NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(header_add);
+NGX_HTTP_SECURITY_HEADERS_SEMAPHORE(hsts);
+
+#define ngx_http_security_headers_probe_enabled(name)                         \
+    __builtin_expect(security_headers_##name##_semaphore, 0)
+
+#define ngx_http_security_headers_probe3(name, a, b, c)                       \
+    DTRACE_PROBE3(security_headers, name, a, b, c)
+#define ngx_http_security_headers_probe4(name, a, b, c, d)                    \
+    DTRACE_PROBE4(security_headers, name, a, b, c, d)
+#define ngx_http_security_headers_probe5(name, a, b, c, d, e)                 \
+    DTRACE_PROBE5(security_headers, name, a, b, c, d, e)
+#define ngx_http_security_headers_probe7(name, a, b, c, d, e, f, g)           \
+    DTRACE_PROBE7(security_headers, name, a, b, c, d, e, f, g)
+
+#define ngx_http_security_headers_probe_entry(r)                              \
+    ((ngx_http_security_headers_probe_enabled(filter_entry)                   \
+      || ngx_http_security_headers_probe_enabled(filter_exit))                \
+     ? ngx_http_security_headers_probe_start(r) : 0)
+
+static uint64_t ngx_http_security_headers_probe_start(ngx_http_request_t *r);
+static void ngx_http_security_headers_probe_exit(ngx_http_request_t *r,
+    ngx_int_t class, uint64_t start);
+
+#else
+
+#define ngx_http_security_headers_probe_enabled(name)  0
+#define ngx_http_security_headers_probe3(name, a, b, c)
+#define ngx_http_security_headers_probe4(name, a, b, c, d)
+#define ngx_http_security_headers_probe5(name, a, b, c, d, e)
+#define ngx_http_security_headers_probe7(name, a, b, c, d, e, f, g)
+
+#define ngx_http_security_headers_probe_entry(r)       0
+#define ngx_http_security_headers_probe_exit(r, class, start)  (void) start
+
+#endif
+
 
 static ngx_str_t hide_headers[] = {
     ngx_string("x-powered-by"),
@@ -89,6 +95,120 @@ static ngx_str_t hide_headers[] = {
     ngx_string("x-hacker")
 };
 
+ngx_http_security_headers_name_t
+    ngx_http_security_headers_managed[NGX_HTTP_SECURITY_HEADERS_MANAGED] =
+{
+    { ngx_string("X-Content-Type-Options"),
+      ngx_string("x-content-type-options") },
+    { ngx_string("X-XSS-Protection"),
+      ngx_string("x-xss-protection") },
+    { ngx_string("Strict-Transport-Security"),
+      ngx_string("strict-transport-security") },
+    { ngx_string("X-Frame-Options"),
+      ngx_string("x-frame-options") },
+    { ngx_string("Referrer-Policy"),
+      ngx_string("referrer-policy") },
+    { ngx_string("Cross-Origin-Resource-Policy"),
+      ngx_string("cross-origin-resource-policy") },
+    { ngx_string("Cross-Origin-Opener-Policy"),
+      ngx_string("cross-origin-opener-policy") },
+    { ngx_string("Cross-Origin-Embedder-Policy"),
+      ngx_string("cross-origin-embedder-policy") },
+    { ngx_string("Content-Security-Policy"),
+      ngx_string("content-security-policy") },
+    { ngx_string("Reporting-Endpoints"),
+      ngx_string("reporting-endpoints") },
+    { ngx_string("Report-To"),
+      ngx_string("report-to") }
+};
+
+static ngx_str_t  ngx_http_security_headers_xcto_value = ngx_string("nosniff");
+
+static ngx_str_t  ngx_http_security_headers_cookie_name =
+    ngx_string("set-cookie");
+static ngx_http_security_headers_action_t
+    ngx_http_security_headers_cookie_action = {
+    NGX_HTTP_SECURITY_HEADERS_ACTION_COOKIE, 0
+};
+static ngx_str_t  ngx_http_security_headers_sandbox_value = ngx_string("sandbox");
+
+/* Header values, indexed by the directive values */
+
+static ngx_str_t  ngx_http_security_headers_xss_values[] = {
+    ngx_null_string,
+    ngx_string("0"),
+    ngx_string("1"),
+    ngx_string("1; mode=block"),
+    ngx_string("")
+};
+
+static ngx_str_t  ngx_http_security_headers_fo_values[] = {
+    ngx_null_string,
+    ngx_string("SAMEORIGIN"),
+    ngx_string("DENY")
+};
+
+static ngx_str_t  ngx_http_security_headers_rp_values[] = {
+    ngx_null_string,
+    ngx_string("no-referrer"),
+    ngx_string("no-referrer-when-downgrade"),
+    ngx_string("same-origin"),
+    ngx_string("origin"),
+    ngx_string("strict-origin"),
+    ngx_string("origin-when-cross-origin"),
+    ngx_string("strict-origin-when-cross-origin"),
+    ngx_string("unsafe-url")
+};
+
+static ngx_str_t  ngx_http_security_headers_corp_values[] = {
+    ngx_null_string,
+    ngx_string("same-site"),
+    ngx_string("same-origin"),
+    ngx_string("cross-origin")
+};
+
+static ngx_str_t  ngx_http_security_headers_coop_values[] = {
+    ngx_null_string,
+    ngx_string("same-origin"),
+    ngx_string("same-origin-allow-popups"),
+    ngx_string("unsafe-none")
+};
+
+static ngx_str_t  ngx_http_security_headers_coep_values[] = {
+    ngx_null_string,
+    ngx_string("require-corp"),
+    ngx_string("credentialless"),
+    ngx_string("unsafe-none")
+};
+
+/* The same values sent to the security_headers_report_to endpoint */
+
+#define ngx_http_security_headers_reported(value)                             \
+    ngx_string(value "; report-to=\""                                         \
+               NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP "\"")
+
+static ngx_str_t  ngx_http_security_headers_coop_reported[] = {
+    ngx_null_string,
+    ngx_http_security_headers_reported("same-origin"),
+    ngx_http_security_headers_reported("same-origin-allow-popups"),
+    ngx_http_security_headers_reported("unsafe-none")
+};
+
+static ngx_str_t  ngx_http_security_headers_coep_reported[] = {
+    ngx_null_string,
+    ngx_http_security_headers_reported("require-corp"),
+    ngx_http_security_headers_reported("credentialless"),
+    ngx_http_security_headers_reported("unsafe-none")
+};
+
+static ngx_str_t  ngx_http_security_headers_sandbox_reported =
+    ngx_string("sandbox; report-to " NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP);
+
+static ngx_str_t  ngx_http_security_headers_hsts_values[] = {
+    ngx_string("max-age=31536000; includeSubDomains"),
+    ngx_string("max-age=31536000; includeSubDomains; preload")
+};
+
 static ngx_conf_enum_t  ngx_http_xss_protection[] = {
     { ngx_string("off"),    NGX_HTTP_XSS_HEADER_OFF },
     { ngx_string("on"),     NGX_HTTP_XSS_HEADER_ON },
@@ -158,12 +278,88 @@ static ngx_conf_enum_t  ngx_http_coep[] = {
 };
 
 static ngx_int_t ngx_http_security_headers_filter(ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_filter_pass(ngx_http_request_t *r);
+static void ngx_http_security_headers_done(ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_filter_hide(ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_filter_full(ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_filter_headers(
+    ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_server(ngx_http_request_t *r);
+#if (nginx_version >= 1029000)
+static ngx_int_t ngx_http_security_headers_early_hints_filter(
+    ngx_http_request_t *r);
+#endif
+static ngx_uint_t ngx_http_security_headers_classify(ngx_http_request_t *r,
+    ngx_http_security_headers_types_t *types);
+static ngx_uint_t ngx_http_security_headers_type_class(
+    ngx_http_security_headers_types_t *types, u_char *lowcase, size_t len,
+    ngx_uint_t hash);
+static ngx_uint_t ngx_http_security_headers_https(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf);
+static ngx_uint_t ngx_http_security_headers_trusted_peer(ngx_connection_t *c,
+    ngx_http_security_headers_trusted_t *trusted);
+static ngx_uint_t ngx_http_security_headers_https_token(ngx_str_t *value,
+    ngx_uint_t forwarded);
+static char *ngx_http_security_headers_trust_from(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_http_security_headers_action_t *ngx_http_security_headers_lookup(
+    ngx_http_security_headers_names_t *names, ngx_table_elt_t *h, u_char *buf);
+static ngx_int_t ngx_http_security_headers_rewrite(ngx_http_request_t *r,
+    ngx_flag_t hide, ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_block_t *block,
+    ngx_uint_t *clean);
+static ngx_int_t ngx_http_security_headers_splice(ngx_http_request_t *r,
+    ngx_http_security_headers_block_t *block);
+#if (NGX_OPENSSL)
+static ngx_uint_t ngx_http_security_headers_upstream_csp(
+    ngx_http_request_t *r);
+#endif
+static void *ngx_http_security_headers_create_main_conf(ngx_conf_t *cf);
+static char *ngx_http_security_headers_init_main_conf(ngx_conf_t *cf,
+    void *conf);
 static void *ngx_http_security_headers_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_security_headers_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static ngx_int_t ngx_http_security_headers_serialize(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+static ngx_int_t ngx_http_security_headers_block(ngx_conf_t *cf,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_block_t *block);
+static ngx_int_t ngx_http_security_headers_add_entry(ngx_array_t *plan,
+    ngx_uint_t index, ngx_str_t *value, ngx_uint_t conditions,
+    ngx_uint_t classes);
+static ngx_int_t ngx_http_security_headers_compile_types(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+static ngx_int_t ngx_http_security_headers_init_names(ngx_conf_t *cf,
+    ngx_http_security_headers_names_t *names, ngx_array_t *hide,
+    ngx_array_t *prefixes);
+static ngx_int_t ngx_http_security_headers_compile_names(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+static ngx_uint_t ngx_http_security_headers_bucket_size(ngx_hash_key_t *keys,
+    ngx_uint_t n);
+static ngx_int_t ngx_http_security_headers_share_key(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf, ngx_uint_t kind,
+    ngx_str_t *key);
+static ngx_int_t ngx_http_security_headers_key_add(ngx_array_t *key,
+    void *data, size_t len);
+static ngx_int_t ngx_http_security_headers_key_str(ngx_array_t *key,
+    ngx_str_t *str);
+static size_t ngx_http_security_headers_pool_used(ngx_pool_t *pool);
+static ngx_int_t ngx_http_security_headers_cmp_wildcards(const void *one,
+    const void *two);
+static char *ngx_http_security_headers_types(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_security_headers_hide(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_http_security_headers_hidden_t *ngx_http_security_headers_hidden(
+    ngx_array_t *hidden, ngx_str_t *name, ngx_uint_t prefix);
+static ngx_int_t ngx_http_security_headers_add_variables(ngx_conf_t *cf);
+static ngx_int_t ngx_http_security_headers_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_security_headers_init(ngx_conf_t *cf);
-static ngx_int_t ngx_set_headers_out_by_search(ngx_http_request_t *r,
-    ngx_str_t *key, ngx_str_t *value);
+static ngx_int_t ngx_http_security_headers_init_module(ngx_cycle_t *cycle);
+static ngx_int_t ngx_http_security_headers_init_process(ngx_cycle_t *cycle);
+static void ngx_http_security_headers_exit_process(ngx_cycle_t *cycle);
 
 ngx_str_t  ngx_http_security_headers_default_text_types[] = {
     ngx_string("text/html"),
@@ -173,6 +369,36 @@ ngx_str_t  ngx_http_security_headers_default_text_types[] = {
     ngx_null_string
 };
 
+static ngx_conf_enum_t  ngx_http_security_headers_type_classes[] = {
+    { ngx_string("standard"), NGX_HTTP_SECURITY_HEADERS_TYPE_STANDARD },
+    { ngx_string("document"), NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT },
+    { ngx_string("sandbox"),  NGX_HTTP_SECURITY_HEADERS_TYPE_SANDBOX },
+    { ngx_string("nosniff"),  NGX_HTTP_SECURITY_HEADERS_TYPE_NOSNIFF },
+    { ngx_null_string, 0 }
+};
+
+static ngx_conf_enum_t  ngx_http_security_headers_csp_learn[] = {
+    { ngx_string("off"),      NGX_HTTP_SECURITY_HEADERS_LEARN_OFF },
+    { ngx_string("uri"),      NGX_HTTP_SECURITY_HEADERS_LEARN_URI },
+    { ngx_string("location"), NGX_HTTP_SECURITY_HEADERS_LEARN_LOCATION },
+    { ngx_null_string, 0 }
+};
+
+static ngx_conf_enum_t  ngx_http_security_headers_fetch_isolation[] = {
+    { ngx_string("off"),    NGX_HTTP_SECURITY_HEADERS_FETCH_OFF },
+    { ngx_string("on"),     NGX_HTTP_SECURITY_HEADERS_FETCH_ON },
+    { ngx_string("report"), NGX_HTTP_SECURITY_HEADERS_FETCH_REPORT },
+    { ngx_null_string, 0 }
+};
+
+static ngx_conf_bitmask_t  ngx_http_security_headers_trust_scheme[] = {
+    { ngx_string("off"), NGX_HTTP_SECURITY_HEADERS_TRUST_OFF },
+    { ngx_string("x-forwarded-proto"), NGX_HTTP_SECURITY_HEADERS_TRUST_XFP },
+    { ngx_string("forwarded"), NGX_HTTP_SECURITY_HEADERS_TRUST_FORWARDED },
+    { ngx_string("proxy_protocol"), NGX_HTTP_SECURITY_HEADERS_TRUST_PROXY },
+    { ngx_null_string, 0 }
+};
+
 static ngx_command_t  ngx_http_security_headers_commands[] = {
 
     { ngx_string( "security_headers" ),
@@ -189,32 +415,39 @@ static ngx_command_t  ngx_http_security_headers_commands[] = {
       offsetof(ngx_http_security_headers_loc_conf_t, hide_server_tokens ),
       NULL },
 
+    { ngx_string("security_headers_subrequests"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, subrequests),
+      NULL },
+
     { ngx_string( "security_headers_hsts_preload" ),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, hsts_preload ),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.hsts_preload),
       NULL },
 
     { ngx_string("security_headers_xss"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, xss),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.xss),
       ngx_http_xss_protection },
 
      { ngx_string("security_headers_frame"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, fo),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.fo),
       ngx_http_frame_options },
 
     { ngx_string("security_headers_referrer_policy"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, rp),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.rp),
       ngx_http_referrer_policy },
 
     { ngx_string("security_headers_text_types"),
@@ -224,37 +457,216 @@ static ngx_command_t  ngx_http_security_headers_commands[] = {
       offsetof(ngx_http_security_headers_loc_conf_t, text_types_keys),
       &ngx_http_security_headers_default_text_types[0] },
 
+    { ngx_string("security_headers_types"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_2MORE,
+      ngx_http_security_headers_types,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, type_rules),
+      NULL },
+
+    { ngx_string("security_headers_hide"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_security_headers_hide,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, hide),
+      NULL },
+
+    { ngx_string("security_headers_hide_prefix"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_security_headers_hide,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, hide_prefixes),
+      NULL },
+
+    { ngx_string("security_headers_hide_upstream"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, hide_upstream),
+      NULL },
+
     { ngx_string("security_headers_corp"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, corp),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.corp),
       ngx_http_corp },
 
     { ngx_string("security_headers_coop"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, coop),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.coop),
       ngx_http_coop },
 
     { ngx_string("security_headers_coep"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(ngx_http_security_headers_loc_conf_t, coep),
+      offsetof(ngx_http_security_headers_loc_conf_t, policy.coep),
       ngx_http_coep },
 
+    { ngx_string("security_headers_fetch_isolation"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, fetch_isolation),
+      ngx_http_security_headers_fetch_isolation },
+
+    { ngx_string("security_headers_fetch_allow"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_bitmask_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, fetch_allow),
+      &ngx_http_security_headers_fetch_values },
+
+    { ngx_string("security_headers_csp_learn"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, csp_learn),
+      ngx_http_security_headers_csp_learn },
+
+    { ngx_string("security_headers_csp_learn_size"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_main_conf_t, learn_size),
+      NULL },
+
+    { ngx_string("security_headers_csp_nonce"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, csp_nonce),
+      NULL },
+
+    { ngx_string("security_headers_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, cache),
+      NULL },
+
+    { ngx_string("security_headers_preserialize"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, preserialize),
+      NULL },
+
+    { ngx_string("security_headers_policy"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_security_headers_policy,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, policy_id),
+      NULL },
+
+    { ngx_string("security_headers_policy_api"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_security_headers_policy_api,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("security_headers_host_map"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_security_headers_host_map,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, host_map),
+      NULL },
+
+    { ngx_string("security_headers_report_to"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_security_headers_report_to,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, report),
+      NULL },
+
+    { ngx_string("security_headers_report_log"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE123,
+      ngx_http_security_headers_report_log,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("security_headers_report_collector"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_security_headers_report_collector,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("security_headers_stats"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_main_conf_t, stats),
+      NULL },
+
+    { ngx_string("security_headers_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_security_headers_status,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("security_headers_trust_from"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_security_headers_trust_from,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("security_headers_trust_scheme"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_conf_set_bitmask_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, trust_scheme),
+      &ngx_http_security_headers_trust_scheme },
+
+    { ngx_string("security_headers_cookie_flags"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_security_headers_cookie_flags,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_security_headers_loc_conf_t, cookie_flags),
+      &ngx_http_security_headers_cookie_values },
+
       ngx_null_command
 };
 
 
+static ngx_http_variable_t  ngx_http_security_headers_vars[] = {
+
+    { ngx_string("security_headers_added"), NULL,
+      ngx_http_security_headers_variable,
+      offsetof(ngx_http_security_headers_ctx_t, added),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("security_headers_replaced"), NULL,
+      ngx_http_security_headers_variable,
+      offsetof(ngx_http_security_headers_ctx_t, replaced),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("security_headers_stripped"), NULL,
+      ngx_http_security_headers_variable,
+      offsetof(ngx_http_security_headers_ctx_t, removed),
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("security_headers_policy_version"), NULL,
+      ngx_http_security_headers_policy_variable, 0,
+      NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+      ngx_http_null_variable
+};
+
+
 static ngx_http_module_t  ngx_http_security_headers_module_ctx = {
-    NULL,                                  /* preconfiguration */
+    ngx_http_security_headers_add_variables, /* preconfiguration */
     ngx_http_security_headers_init,        /* postconfiguration */
 
-    NULL,                                  /* create main configuration */
-    NULL,                                  /* init main configuration */
+    ngx_http_security_headers_create_main_conf, /* create main configuration */
+    ngx_http_security_headers_init_main_conf,   /* init main configuration */
 
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
@@ -270,11 +682,11 @@ ngx_module_t  ngx_http_security_headers_module = {
     ngx_http_security_headers_commands,          /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
-    NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_security_headers_init_module, /* init module */
+    ngx_http_security_headers_init_process, /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_http_security_headers_exit_process, /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -283,322 +695,374 @@ ngx_module_t  ngx_http_security_headers_module = {
 /* next header filter in chain */
 
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
+#if (nginx_version >= 1029000)
+static ngx_http_output_header_filter_pt  ngx_http_next_early_hints_filter;
+#endif
+
+/*
+ * A response whose headers are done, marked in a request without a context
+ * of its own; it is never written to
+ */
 
-/* header filter handler */
+static ngx_http_security_headers_ctx_t  ngx_http_security_headers_done_ctx = {
+    0, 0, 0, NULL, 1, 0, { 0 }
+};
+
+
+/*
+ * header filter handler, runs the variant the location picked at merge
+ * time: pass, hide, headers or full.  The headers of subrequests, such as
+ * SSI includes, never reach the client and are left alone unless
+ * security_headers_subrequests is set.  A second pass over the headers of
+ * a main request is free; an internal redirect or a special response
+ * clears the context, and with it the mark.
+ */
 
 static ngx_int_t
 ngx_http_security_headers_filter(ngx_http_request_t *r)
 {
+    ngx_http_security_headers_ctx_t       *ctx;
     ngx_http_security_headers_loc_conf_t  *slcf;
 
-    ngx_table_elt_t   *h_server;
-
-    ngx_str_t   key;
-    ngx_str_t   val;
-
-    ngx_str_t  scheme          = ngx_string("scheme");
-    ngx_uint_t scheme_hash_key = ngx_hash_key(scheme.data, scheme.len);
-    ngx_http_variable_value_t *scheme_value;
-
     slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
 
-    if (1 == slcf->hide_server_tokens) {
-        /* Hide the Server header */
-        h_server = r->headers_out.server;
-        if (h_server == NULL) {
-            h_server = ngx_list_push(&r->headers_out.headers);
-            if (h_server == NULL) {
-                return NGX_ERROR;
-            }
-            ngx_str_set(&h_server->key, "Server");
-            ngx_str_set(&h_server->value, "");
-            r->headers_out.server = h_server;
+    if (r != r->main) {
+        if (!slcf->subrequests) {
+            return ngx_http_next_header_filter(r);
         }
-        h_server->hash = 0;
 
-        size_t hide_headers_count = sizeof(hide_headers) / sizeof(hide_headers[0]);
-        size_t i;
-        for (i = 0; i < hide_headers_count; ++i) {
-            ngx_set_headers_out_by_search(r, &hide_headers[i], &empty_val);
+    } else {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_security_headers_module);
+
+        if (ctx && ctx->done) {
+            return ngx_http_next_header_filter(r);
         }
     }
 
-    if (1 != slcf->enable) {
-        return ngx_http_next_header_filter(r);
+    return slcf->handler(r);
+}
+
+
+/* marks the headers of the main request done */
+
+static void
+ngx_http_security_headers_done(ngx_http_request_t *r)
+{
+    ngx_http_security_headers_ctx_t  *ctx;
+
+    if (r != r->main) {
+        return;
     }
 
-    /* add X-Content-Type-Options to output */
-    if (r->headers_out.status == NGX_HTTP_OK) {
-        ngx_str_set(&key, "X-Content-Type-Options");
-        ngx_str_set(&val, "nosniff");
+    ctx = ngx_http_get_module_ctx(r, ngx_http_security_headers_module);
 
-        ngx_set_headers_out_by_search(r, &key, &val);
+    if (ctx) {
+        ctx->done = 1;
+        return;
     }
 
-    /* Handle X-XSS-Protection (deprecated header) */
-    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED
-        && NGX_HTTP_SECURITY_HEADER_OMIT != slcf->xss)
-    {
-        ngx_str_set(&key, "X-XSS-Protection");
+    ngx_http_set_ctx(r, &ngx_http_security_headers_done_ctx,
+                     ngx_http_security_headers_module);
+}
 
-        if (slcf->xss == NGX_HTTP_XSS_HEADER_UNSET) {
-            /* Actively remove the deprecated X-XSS-Protection header */
-            ngx_set_headers_out_by_search(r, &key, &empty_val);
-        } else if (ngx_http_test_content_type(r, &slcf->text_types) != NULL) {
-            switch (slcf->xss) {
-                case NGX_HTTP_XSS_HEADER_ON:
-                    ngx_str_set(&val, "1");
-                    break;
-                case NGX_HTTP_XSS_HEADER_BLOCK:
-                    ngx_str_set(&val, "1; mode=block");
-                    break;
-                case NGX_HTTP_XSS_HEADER_OFF:
-                    ngx_str_set(&val, "0");
-                    break;
-                default:
-                    val.len = 0;
-                    val.data = NULL;
-            }
 
-            if (val.data) {
-                ngx_set_headers_out_by_search(r, &key, &val);
-            }
-        }
-    }
+/* neither security_headers nor hide_server_tokens */
 
-    scheme_value = ngx_http_get_variable(r, &scheme, scheme_hash_key);
-    if (scheme_value && !scheme_value->not_found && scheme_value->len == 5 && ngx_strncmp(scheme_value->data, "https", 5) == 0)
-    {
-        ngx_str_set(&key, "Strict-Transport-Security");
-        if (1 == slcf->hsts_preload) {
-            ngx_str_set(&val, "max-age=31536000; includeSubDomains; preload");
-        } else {
-            ngx_str_set(&val, "max-age=31536000; includeSubDomains");
-        }
-        ngx_set_headers_out_by_search(r, &key, &val);
-    }
+static ngx_int_t
+ngx_http_security_headers_filter_pass(ngx_http_request_t *r)
+{
+    return ngx_http_next_header_filter(r);
+}
 
-    /* Add X-Frame-Options */
-    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED
-        && NGX_HTTP_SECURITY_HEADER_OMIT != slcf->fo
-        && ngx_http_test_content_type(r, &slcf->text_types) != NULL)
-    {
 
-        switch (slcf->fo) {
-            case NGX_HTTP_FO_HEADER_SAME:
-                ngx_str_set(&val, "SAMEORIGIN");
-                break;
-            case NGX_HTTP_FO_HEADER_DENY:
-                ngx_str_set(&val, "DENY");
-                break;
-            default:
-                val.len = 0;
-                val.data = NULL;
-        }
+/* hide_server_tokens only: the Server header and the hidden headers */
 
-        if (val.data) {
-            ngx_str_set(&key, "X-Frame-Options");
-            ngx_set_headers_out_by_search(r, &key, &val);
-        }
-    }
+static ngx_int_t
+ngx_http_security_headers_filter_hide(ngx_http_request_t *r)
+{
+    uint64_t                                start;
+    ngx_http_security_headers_main_conf_t  *smcf;
 
-    /* Referrer-Policy: no-referrer-when-downgrade */
-    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED
-        && NGX_HTTP_SECURITY_HEADER_OMIT != slcf->rp) {
+    ngx_http_security_headers_entry_t  *entries[NGX_HTTP_SECURITY_HEADERS_MANAGED];
 
-            switch (slcf->rp) {
-                case NGX_HTTP_RP_HEADER_NO:
-                    ngx_str_set(&val, "no-referrer");
-                    break;
-                case NGX_HTTP_RP_HEADER_DOWNGRADE:
-                    ngx_str_set(&val, "no-referrer-when-downgrade");
-                    break;
-                case NGX_HTTP_RP_HEADER_SAME_ORIGIN:
-                    ngx_str_set(&val, "same-origin");
-                    break;
-                case NGX_HTTP_RP_HEADER_ORIGIN:
-                    ngx_str_set(&val, "origin");
-                    break;
-                case NGX_HTTP_RP_HEADER_STRICT_ORIGIN:
-                    ngx_str_set(&val, "strict-origin");
-                    break;
-                case NGX_HTTP_RP_HEADER_ORIGIN_WHEN_CROSS:
-                    ngx_str_set(&val, "origin-when-cross-origin");
-                    break;
-                case NGX_HTTP_RP_HEADER_STRICT_ORIG_WHEN_CROSS:
-                    ngx_str_set(&val, "strict-origin-when-cross-origin");
-                    break;
-                case NGX_HTTP_RP_HEADER_UNSAFE_URL:
-                    ngx_str_set(&val, "unsafe-url");
-                    break;
-                default:
-                    val.len = 0;
-                    val.data = NULL;
-            }
-        if (val.data) {
-            ngx_str_set(&key, "Referrer-Policy");
-            ngx_set_headers_out_by_search(r, &key, &val);
-        }
+    start = ngx_http_security_headers_probe_entry(r);
+
+    if (ngx_http_security_headers_server(r) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    /* Cross-Origin-Resource-Policy */
-    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED
-        && NGX_HTTP_SECURITY_HEADER_OMIT != slcf->corp)
-    {
-        switch (slcf->corp) {
-            case NGX_HTTP_CORP_HEADER_SAME_SITE:
-                ngx_str_set(&val, "same-site");
-                break;
-            case NGX_HTTP_CORP_HEADER_SAME_ORIGIN:
-                ngx_str_set(&val, "same-origin");
-                break;
-            case NGX_HTTP_CORP_HEADER_CROSS_ORIGIN:
-                ngx_str_set(&val, "cross-origin");
-                break;
-            default:
-                val.len = 0;
-                val.data = NULL;
-        }
-        if (val.data) {
-            ngx_str_set(&key, "Cross-Origin-Resource-Policy");
-            ngx_set_headers_out_by_search(r, &key, &val);
-        }
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    if (smcf->counters) {
+        smcf->counters[NGX_HTTP_SECURITY_HEADERS_STAT_RESPONSES]++;
     }
 
-    /* Cross-Origin-Opener-Policy */
-    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED
-        && NGX_HTTP_SECURITY_HEADER_OMIT != slcf->coop)
+    ngx_memzero(entries, sizeof(entries));
+
+    if (ngx_http_security_headers_rewrite(r, 1, entries, NULL, NULL)
+        != NGX_OK)
     {
-        switch (slcf->coop) {
-            case NGX_HTTP_COOP_HEADER_SAME_ORIGIN:
-                ngx_str_set(&val, "same-origin");
-                break;
-            case NGX_HTTP_COOP_HEADER_SAME_ORIGIN_ALLOW_POPUPS:
-                ngx_str_set(&val, "same-origin-allow-popups");
-                break;
-            case NGX_HTTP_COOP_HEADER_UNSAFE_NONE:
-                ngx_str_set(&val, "unsafe-none");
-                break;
-            default:
-                val.len = 0;
-                val.data = NULL;
-        }
-        if (val.data) {
-            ngx_str_set(&key, "Cross-Origin-Opener-Policy");
-            ngx_set_headers_out_by_search(r, &key, &val);
-        }
+        return NGX_ERROR;
     }
 
-    /* Cross-Origin-Embedder-Policy */
-    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED
-        && NGX_HTTP_SECURITY_HEADER_OMIT != slcf->coep)
-    {
-        switch (slcf->coep) {
-            case NGX_HTTP_COEP_HEADER_REQUIRE_CORP:
-                ngx_str_set(&val, "require-corp");
-                break;
-            case NGX_HTTP_COEP_HEADER_CREDENTIALLESS:
-                ngx_str_set(&val, "credentialless");
-                break;
-            case NGX_HTTP_COEP_HEADER_UNSAFE_NONE:
-                ngx_str_set(&val, "unsafe-none");
-                break;
-            default:
-                val.len = 0;
-                val.data = NULL;
-        }
-        if (val.data) {
-            ngx_str_set(&key, "Cross-Origin-Embedder-Policy");
-            ngx_set_headers_out_by_search(r, &key, &val);
-        }
+    ngx_http_security_headers_done(r);
+
+    /* the response is not classified */
+
+    if (ngx_http_security_headers_probe_enabled(filter_exit)) {
+        ngx_http_security_headers_probe_exit(r, -1, start);
     }
 
-    /* proceed to the next handler in chain */
     return ngx_http_next_header_filter(r);
 }
 
 
-static void *
-ngx_http_security_headers_create_loc_conf(ngx_conf_t *cf)
-{
-    ngx_http_security_headers_loc_conf_t  *conf;
+/* both security_headers and hide_server_tokens */
 
-    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_security_headers_loc_conf_t));
-    if (conf == NULL) {
-        return NULL;
+static ngx_int_t
+ngx_http_security_headers_filter_full(ngx_http_request_t *r)
+{
+    if (ngx_http_security_headers_server(r) != NGX_OK) {
+        return NGX_ERROR;
     }
 
-    conf->xss =    NGX_CONF_UNSET_UINT;
-    conf->fo  =    NGX_CONF_UNSET_UINT;
-    conf->rp  =    NGX_CONF_UNSET_UINT;
-    conf->corp =   NGX_CONF_UNSET_UINT;
-    conf->coop =   NGX_CONF_UNSET_UINT;
-    conf->coep =   NGX_CONF_UNSET_UINT;
-    conf->enable = NGX_CONF_UNSET;
-    conf->hide_server_tokens = NGX_CONF_UNSET_UINT;
-    conf->hsts_preload = NGX_CONF_UNSET_UINT;
-
-    return conf;
+    return ngx_http_security_headers_filter_headers(r);
 }
 
 
-static char *
-ngx_http_security_headers_merge_loc_conf(ngx_conf_t *cf, void *parent,
-    void *child)
-{
-    ngx_http_security_headers_loc_conf_t *prev = parent;
-    ngx_http_security_headers_loc_conf_t *conf = child;
+/*
+ * hides the Server header: an entry with zero hash is not sent, and keeps
+ * the header filter from adding its own
+ */
 
-    ngx_conf_merge_value(conf->enable, prev->enable, 0);
-    ngx_conf_merge_value(conf->hide_server_tokens, prev->hide_server_tokens, 0);
-    ngx_conf_merge_value(conf->hsts_preload, prev->hsts_preload, 1);
+static ngx_int_t
+ngx_http_security_headers_server(ngx_http_request_t *r)
+{
+    ngx_table_elt_t  *h_server;
+
+    h_server = r->headers_out.server;
+    if (h_server == NULL) {
+        h_server = ngx_list_push(&r->headers_out.headers);
+        if (h_server == NULL) {
+            return NGX_ERROR;
+        }
+        ngx_str_set(&h_server->key, "Server");
+        ngx_str_set(&h_server->value, "");
+        r->headers_out.server = h_server;
+    }
+    h_server->hash = 0;
+
+    return NGX_OK;
+}
+
+
+/* security_headers: selects the managed headers and rewrites the response */
+
+static ngx_int_t
+ngx_http_security_headers_filter_headers(ngx_http_request_t *r)
+{
+    ngx_uint_t                              i, mask, class, conditions,
+                                            typed, clean;
+    uint64_t                                start;
+    ngx_array_t                            *plan;
+    ngx_http_security_headers_block_t      *block, *blocks;
+    ngx_http_security_headers_ctx_t        *ctx;
+    ngx_http_security_headers_entry_t      *entry;
+    ngx_http_security_headers_memo_t       *memo;
+    ngx_http_security_headers_learn_t      *learn;
+    ngx_http_security_headers_runtime_t    *rt;
+    ngx_http_security_headers_host_plan_t  *host;
+    ngx_http_security_headers_loc_conf_t   *slcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    ngx_http_security_headers_entry_t  *entries[NGX_HTTP_SECURITY_HEADERS_MANAGED];
+
+    start = ngx_http_security_headers_probe_entry(r);
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    ngx_memzero(entries, sizeof(entries));
+
+    block = NULL;
+    rt = NULL;
+    memo = NULL;
+    learn = NULL;
+    clean = 0;
+
+    plan = slcf->plan;
+    conditions = slcf->conditions;
+    typed = slcf->typed;
+    blocks = slcf->blocks;
+
+    if (slcf->policy_index != NGX_CONF_UNSET_UINT) {
+        rt = ngx_http_security_headers_policy_current(r, smcf,
+                                                      slcf->policy_index);
+
+        if (rt->plan) {
+            plan = rt->plan;
+            conditions = rt->conditions;
+            typed = rt->typed;
+            blocks = NULL;
+        }
+    }
+
+    /* the policy of the host, if it is in the host map */
+
+    if (slcf->host_map) {
+        host = ngx_http_security_headers_host_lookup(r, slcf);
+
+        if (host) {
+            plan = host->plan;
+            conditions = host->conditions;
+            typed = host->typed;
+            blocks = host->blocks;
+        }
+    }
+
+    /* classify the response once, then pick the plan entries */
+
+    mask = 0;
+
+    if (r->headers_out.status == NGX_HTTP_OK) {
+        mask |= NGX_HTTP_SECURITY_HEADERS_IF_OK;
+    }
+
+    if (r->headers_out.status != NGX_HTTP_NOT_MODIFIED) {
+        mask |= NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED;
+    }
+
+    class = (typed || slcf->csp_learn || slcf->csp_nonce == 1)
+            ? ngx_http_security_headers_classify(r, slcf->types)
+            : NGX_HTTP_SECURITY_HEADERS_TYPE_STANDARD;
+
+    if ((conditions & NGX_HTTP_SECURITY_HEADERS_IF_HTTPS)
+        && ngx_http_security_headers_https(r, slcf))
+    {
+        mask |= NGX_HTTP_SECURITY_HEADERS_IF_HTTPS;
+    }
+
+    entry = plan->elts;
+
+    for (i = 0; i < plan->nelts; i++) {
+        if ((entry[i].conditions & ~mask)
+            || !(entry[i].classes & NGX_HTTP_SECURITY_HEADERS_CLASS(class)))
+        {
+            continue;
+        }
+
+        entries[entry[i].index] = &entry[i];
+    }
+
+    if (blocks) {
+        block = &blocks[class * (NGX_HTTP_SECURITY_HEADERS_IF_ALL + 1)
+                        + mask];
+    }
+
+    /* https is only checked if some header depends on it */
+
+    ngx_http_security_headers_probe3(hsts, r,
+                           (mask & NGX_HTTP_SECURITY_HEADERS_IF_HTTPS) != 0,
+                           entries[NGX_HTTP_SECURITY_HEADERS_HSTS] != NULL);
+
+#if (NGX_OPENSSL)
+    if ((slcf->csp_learn || slcf->csp_nonce == 1)
+        && class == NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT
+        && entries[NGX_HTTP_SECURITY_HEADERS_CSP] == NULL
+        && !ngx_http_security_headers_upstream_csp(r))
+    {
+        /* a nonce allows any inline element, nothing is left to learn */
+
+        if (slcf->csp_nonce == 1) {
+            if (ngx_http_security_headers_nonce_header(r, slcf, entries,
+                                                       &learn)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else if (ngx_http_security_headers_learn_header(r, slcf, entries,
+                                                          &learn)
+                   != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (entries[NGX_HTTP_SECURITY_HEADERS_CSP]) {
+            /* the learned or nonce policy is not in the block */
+            block = NULL;
+        }
+    }
+#endif
+
+#if (NGX_HTTP_CACHE)
+    if (slcf->cache == 1 && r->cached && smcf->memo) {
+        memo = ngx_http_security_headers_cache_lookup(r, smcf, plan, rt,
+                                                      &clean);
+    }
+#endif
+
+    if (smcf->counters) {
+        smcf->counters[NGX_HTTP_SECURITY_HEADERS_STAT_RESPONSES]++;
+
+        if (entries[NGX_HTTP_SECURITY_HEADERS_HSTS]) {
+            smcf->counters[NGX_HTTP_SECURITY_HEADERS_STAT_HSTS]++;
+        }
+    }
 
-    if (ngx_http_merge_types(cf, &conf->text_types_keys, &conf->text_types,
-                             &prev->text_types_keys, &prev->text_types,
-                             ngx_http_security_headers_default_text_types)
+    if (ngx_http_security_headers_rewrite(r, slcf->hide_server_tokens, entries,
+                                          block, memo ? &clean : NULL)
         != NGX_OK)
     {
-        return NGX_CONF_ERROR;
+        return NGX_ERROR;
     }
 
-    ngx_conf_merge_uint_value(conf->xss, prev->xss,
-                              NGX_HTTP_XSS_HEADER_UNSET);
-    ngx_conf_merge_uint_value(conf->fo, prev->fo,
-                              NGX_HTTP_FO_HEADER_SAME);
-    ngx_conf_merge_uint_value(conf->rp, prev->rp,
-                              NGX_HTTP_RP_HEADER_STRICT_ORIG_WHEN_CROSS);
+#if (NGX_HTTP_CACHE)
+    if (memo) {
+        ngx_http_security_headers_cache_record(r, memo, plan, rt, clean);
+    }
+#endif
 
-    /* CORP defaults to same-site (opt-out), COOP/COEP default to omit (opt-in) */
-    ngx_conf_merge_uint_value(conf->corp, prev->corp,
-                              NGX_HTTP_CORP_HEADER_SAME_SITE);
-    ngx_conf_merge_uint_value(conf->coop, prev->coop,
-                              NGX_HTTP_SECURITY_HEADER_OMIT);
-    ngx_conf_merge_uint_value(conf->coep, prev->coep,
-                              NGX_HTTP_SECURITY_HEADER_OMIT);
+    if (learn) {
+        ctx = ngx_http_get_module_ctx(r, ngx_http_security_headers_module);
 
-    return NGX_CONF_OK;
-}
+        if (ctx == NULL) {
+            ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_security_headers_ctx_t));
+            if (ctx == NULL) {
+                return NGX_ERROR;
+            }
 
+            ngx_http_set_ctx(r, ctx, ngx_http_security_headers_module);
+        }
 
-static ngx_int_t
-ngx_http_security_headers_init(ngx_conf_t *cf)
-{
-    /* install handler in header filter chain */
+        ctx->learn = learn;
+    }
 
-    ngx_http_next_header_filter = ngx_http_top_header_filter;
-    ngx_http_top_header_filter = ngx_http_security_headers_filter;
+    ngx_http_security_headers_done(r);
 
-    return NGX_OK;
+    if (ngx_http_security_headers_probe_enabled(filter_exit)) {
+        ngx_http_security_headers_probe_exit(r, class, start);
+    }
+
+    /* proceed to the next handler in chain */
+    return ngx_http_next_header_filter(r);
 }
 
-static ngx_int_t
-ngx_set_headers_out_by_search(ngx_http_request_t *r,
-    ngx_str_t *key, ngx_str_t *value)
+
+#if (NGX_OPENSSL)
+
+/*
+ * The response already has a Content-Security-Policy, set by the upstream
+ * or the application: a learned or nonce policy would replace it along
+ * with its own directives, so it is kept instead
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_upstream_csp(ngx_http_request_t *r)
 {
-    ngx_list_part_t            *part;
-    ngx_uint_t                  i;
-    ngx_table_elt_t            *h;
-    ngx_flag_t                  matched = 0;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *h;
 
     part = &r->headers_out.headers.part;
     h = part->elts;
@@ -615,62 +1079,2891 @@ ngx_set_headers_out_by_search(ngx_http_request_t *r,
             i = 0;
         }
 
-        if (h[i].hash == 0) {
-            continue;
+        if (h[i].hash
+            && h[i].key.len == sizeof("Content-Security-Policy") - 1
+            && ngx_strncasecmp(h[i].key.data,
+                               (u_char *) "Content-Security-Policy",
+                               sizeof("Content-Security-Policy") - 1)
+               == 0)
+        {
+            return 1;
         }
+    }
+
+    return 0;
+}
+
+#endif
+
+
+#if (nginx_version >= 1029000)
+
+/*
+ * 103 Early Hints get the managed headers which apply before the final
+ * response, as a text/html response of the location would have them, and
+ * lose the hidden headers as the final response does.  Conditions on the
+ * final status and on HTTPS do not hold yet.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_early_hints_filter(ngx_http_request_t *r)
+{
+    ngx_uint_t                              i, class;
+    ngx_array_t                            *plan;
+    ngx_http_security_headers_block_t      *block;
+    ngx_http_security_headers_entry_t      *entry;
+    ngx_http_security_headers_runtime_t    *rt;
+    ngx_http_security_headers_host_plan_t  *host;
+    ngx_http_security_headers_loc_conf_t   *slcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
 
-        if (h[i].key.len == key->len
-            && ngx_strncasecmp(h[i].key.data, key->data,
-                               h[i].key.len) == 0)
+    ngx_http_security_headers_entry_t  *entries[NGX_HTTP_SECURITY_HEADERS_MANAGED];
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+
+    ngx_memzero(entries, sizeof(entries));
+
+    if (1 != slcf->enable) {
+
+        /* hide_server_tokens only, as ngx_http_security_headers_filter_hide */
+
+        if (1 == slcf->hide_server_tokens
+            && ngx_http_security_headers_rewrite(r, 1, entries, NULL, NULL)
+               != NGX_OK)
         {
-            goto matched;
+            return NGX_ERROR;
         }
 
-        /* not matched */
-        continue;
-matched:
+        return ngx_http_next_early_hints_filter(r);
+    }
+
+    plan = slcf->plan;
+    block = slcf->interim;
+    class = slcf->interim_class;
 
-        if (value->len == 0 || matched) {
-            h[i].value.len = 0;
-            h[i].hash = 0;
-        } else {
-            h[i].value = *value;
-            h[i].hash = 1;
-        }
+    if (slcf->policy_index != NGX_CONF_UNSET_UINT) {
+        smcf = ngx_http_get_module_main_conf(r,
+                                             ngx_http_security_headers_module);
 
-        matched = 1;
+        rt = ngx_http_security_headers_policy_current(r, smcf,
+                                                      slcf->policy_index);
+        if (rt->plan) {
+            plan = rt->plan;
+            block = NULL;
+        }
     }
 
-    if (matched){
-        return NGX_OK;
+    if (slcf->host_map) {
+        host = ngx_http_security_headers_host_lookup(r, slcf);
+
+        if (host) {
+            plan = host->plan;
+            block = host->interim;
+            class = host->interim_class;
+        }
     }
 
-    /* XXX we still need to create header slot even if the value
-     * is empty because some builtin headers like Last-Modified
-     * relies on this to get cleared */
+    class = NGX_HTTP_SECURITY_HEADERS_CLASS(class);
+    entry = plan->elts;
 
-    h = ngx_list_push(&r->headers_out.headers);
-    if (h == NULL) {
+    for (i = 0; i < plan->nelts; i++) {
+        if (!(NGX_HTTP_SECURITY_HEADERS_INTERIM & (1 << entry[i].index))
+            || (entry[i].conditions & ~NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED)
+            || !(entry[i].classes & class))
+        {
+            continue;
+        }
+
+        entries[entry[i].index] = &entry[i];
+    }
+
+    if (ngx_http_security_headers_rewrite(r, slcf->hide_server_tokens, entries,
+                                          block, NULL)
+        != NGX_OK)
+    {
         return NGX_ERROR;
     }
 
-    if (value->len == 0) {
-        h->hash = 0;
+    return ngx_http_next_early_hints_filter(r);
+}
+
+#endif
 
-    } else {
-        h->hash = 1;
+
+/*
+ * Classifies the response by its content type: an exact type match first,
+ * then the most specific wildcard, then the default class.  The lowercased
+ * type and its hash are cached in r->headers_out the same way
+ * ngx_http_test_content_type() does.
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_classify(ngx_http_request_t *r,
+    ngx_http_security_headers_types_t *types)
+{
+    u_char      *lowcase;
+    size_t       len;
+    ngx_uint_t   i, hash;
+
+    if (r->headers_out.content_type.len == 0) {
+        return types->default_class;
     }
 
-    h->key = *key;
-    h->value = *value;
+    len = r->headers_out.content_type_len;
 
-    h->lowcase_key = ngx_pnalloc(r->pool, h->key.len);
-    if (h->lowcase_key == NULL) {
-        return NGX_ERROR;
+    if (r->headers_out.content_type_lowcase == NULL) {
+
+        lowcase = ngx_pnalloc(r->pool, len);
+        if (lowcase == NULL) {
+            return types->default_class;
+        }
+
+        r->headers_out.content_type_lowcase = lowcase;
+
+        hash = 0;
+
+        for (i = 0; i < len; i++) {
+            lowcase[i] = ngx_tolower(r->headers_out.content_type.data[i]);
+            hash = ngx_hash(hash, lowcase[i]);
+        }
+
+        r->headers_out.content_type_hash = hash;
     }
 
-    ngx_strlow(h->lowcase_key, h->key.data, h->key.len);
+    return ngx_http_security_headers_type_class(types,
+                                          r->headers_out.content_type_lowcase,
+                                          len,
+                                          r->headers_out.content_type_hash);
+}
 
-    return NGX_OK;
+
+static ngx_uint_t
+ngx_http_security_headers_type_class(ngx_http_security_headers_types_t *types,
+    u_char *lowcase, size_t len, ngx_uint_t hash)
+{
+    ngx_uint_t                             i;
+    uintptr_t                              class;
+    ngx_http_security_headers_wildcard_t  *wc;
+
+    class = (uintptr_t) ngx_hash_find(&types->exact, hash, lowcase, len);
+    if (class) {
+        return class - 1;
+    }
+
+    if (types->wildcards) {
+        wc = types->wildcards->elts;
+
+        for (i = 0; i < types->wildcards->nelts; i++) {
+            if (len >= wc[i].prefix.len + wc[i].suffix.len
+                && ngx_memcmp(lowcase, wc[i].prefix.data, wc[i].prefix.len)
+                   == 0
+                && ngx_memcmp(lowcase + len - wc[i].suffix.len,
+                              wc[i].suffix.data, wc[i].suffix.len)
+                   == 0)
+            {
+                return wc[i].class;
+            }
+        }
+    }
+
+    return types->default_class;
+}
+
+
+/*
+ * Tells if the client reached us over https.  This is the $scheme check done
+ * directly on the connection; when the peer is a trusted proxy, the scheme
+ * it reports through the configured metadata is used as well.
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_https(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf)
+{
+    ngx_uint_t        i;
+    ngx_str_t        *xfp, *forwarded;
+    ngx_list_part_t  *part;
+    ngx_table_elt_t  *h;
+#if (nginx_version >= 1023002)
+    ngx_str_t         tlv;
+    ngx_str_t         ssl_tlv = ngx_string("0x20");
+#endif
+
+#if (NGX_HTTP_SSL)
+    if (r->connection->ssl) {
+        return 1;
+    }
+#endif
+
+    if (slcf->trusted == NULL
+        || (slcf->trust_scheme & ~(NGX_CONF_BITMASK_SET
+                                   |NGX_HTTP_SECURITY_HEADERS_TRUST_OFF))
+           == 0
+        || !ngx_http_security_headers_trusted_peer(r->connection,
+                                                   slcf->trusted))
+    {
+        return 0;
+    }
+
+#if (nginx_version >= 1023002)
+    /* PP2_TYPE_SSL, the PP2_CLIENT_SSL bit of its first byte */
+
+    if ((slcf->trust_scheme & NGX_HTTP_SECURITY_HEADERS_TRUST_PROXY)
+        && r->connection->proxy_protocol
+        && ngx_proxy_protocol_get_tlv(r->connection, &ssl_tlv, &tlv) == NGX_OK
+        && tlv.len > 0
+        && (tlv.data[0] & 0x01))
+    {
+        return 1;
+    }
+#endif
+
+    if (!(slcf->trust_scheme & (NGX_HTTP_SECURITY_HEADERS_TRUST_XFP
+                                |NGX_HTTP_SECURITY_HEADERS_TRUST_FORWARDED)))
+    {
+        return 0;
+    }
+
+    /* the last header of a kind is the one added by the nearest proxy */
+
+    xfp = NULL;
+    forwarded = NULL;
+
+    part = &r->headers_in.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].key.len == sizeof("X-Forwarded-Proto") - 1
+            && ngx_strncasecmp(h[i].key.data, (u_char *) "X-Forwarded-Proto",
+                               sizeof("X-Forwarded-Proto") - 1)
+               == 0)
+        {
+            xfp = &h[i].value;
+
+        } else if (h[i].key.len == sizeof("Forwarded") - 1
+                   && ngx_strncasecmp(h[i].key.data, (u_char *) "Forwarded",
+                                      sizeof("Forwarded") - 1)
+                      == 0)
+        {
+            forwarded = &h[i].value;
+        }
+    }
+
+    if ((slcf->trust_scheme & NGX_HTTP_SECURITY_HEADERS_TRUST_XFP)
+        && xfp
+        && ngx_http_security_headers_https_token(xfp, 0))
+    {
+        return 1;
+    }
+
+    if ((slcf->trust_scheme & NGX_HTTP_SECURITY_HEADERS_TRUST_FORWARDED)
+        && forwarded
+        && ngx_http_security_headers_https_token(forwarded, 1))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static ngx_uint_t
+ngx_http_security_headers_trusted_peer(ngx_connection_t *c,
+    ngx_http_security_headers_trusted_t *trusted)
+{
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    u_char               *p;
+    in_addr_t             addr;
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (c->sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) c->sockaddr;
+
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            if (trusted->tree == NULL) {
+                return 0;
+            }
+
+            p = sin6->sin6_addr.s6_addr;
+            addr = (in_addr_t) p[12] << 24;
+            addr |= p[13] << 16;
+            addr |= p[14] << 8;
+            addr |= p[15];
+
+            return ngx_radix32tree_find(trusted->tree, addr)
+                   != NGX_RADIX_NO_VALUE;
+        }
+
+        return trusted->tree6
+               && ngx_radix128tree_find(trusted->tree6,
+                                        sin6->sin6_addr.s6_addr)
+                  != NGX_RADIX_NO_VALUE;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return trusted->unix_domain;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) c->sockaddr;
+
+        return trusted->tree
+               && ngx_radix32tree_find(trusted->tree,
+                                       ntohl(sin->sin_addr.s_addr))
+                  != NGX_RADIX_NO_VALUE;
+
+    default:
+        return 0;
+    }
+}
+
+
+/*
+ * Checks the element added by the nearest proxy, i.e. the last one:
+ * "X-Forwarded-Proto: https" or "Forwarded: for=...;proto=https".
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_https_token(ngx_str_t *value, ngx_uint_t forwarded)
+{
+    u_char  *p, *start, *last;
+
+    start = value->data;
+    last = value->data + value->len;
+
+    for (p = last; p > start; p--) {
+        if (p[-1] == ',') {
+            start = p;
+            break;
+        }
+    }
+
+    if (forwarded) {
+        p = ngx_strlcasestrn(start, last, (u_char *) "proto=",
+                             sizeof("proto=") - 1 - 1);
+        if (p == NULL) {
+            return 0;
+        }
+
+        start = p + sizeof("proto=") - 1;
+
+        if (start < last && *start == '"') {
+            start++;
+        }
+
+        for (p = start; p < last; p++) {
+            if (*p == ';' || *p == '"') {
+                break;
+            }
+        }
+
+        last = p;
+    }
+
+    while (start < last && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+
+    while (last > start && (last[-1] == ' ' || last[-1] == '\t')) {
+        last--;
+    }
+
+    return last - start == 5
+           && ngx_strncasecmp(start, (u_char *) "https", 5) == 0;
 }
 
+
+/*
+ * Finds the action for a response header name.  The name is lowercased into
+ * buf at most once; prefixes reuse the lowercased bytes and a running hash,
+ * so the cost depends on the name, not on the number of configured names.
+ */
+
+static ngx_http_security_headers_action_t *
+ngx_http_security_headers_lookup(ngx_http_security_headers_names_t *names,
+    ngx_table_elt_t *h, u_char *buf)
+{
+    u_char                               c;
+    size_t                               len, n;
+    ngx_uint_t                           i, key;
+    ngx_http_security_headers_action_t  *action;
+
+    len = h->key.len;
+
+    if (len < names->min_len) {
+        return NULL;
+    }
+
+    c = ngx_tolower(h->key.data[0]);
+
+    if (!(names->first[c >> 5] & (1U << (c & 0x1f)))) {
+        return NULL;
+    }
+
+    n = 0;
+
+    if (len <= names->max_len) {
+        action = ngx_http_security_headers_match(names, h->key.data, len, buf);
+        if (action) {
+            return action;
+        }
+
+        n = len;
+    }
+
+    if (names->prefix_lens == 0) {
+        return NULL;
+    }
+
+    key = 0;
+
+    for (i = 0;
+         i < len && i < NGX_HTTP_SECURITY_HEADERS_NAME_LEN
+         && (names->prefix_lens >> i);
+         i++)
+    {
+
+        if (i >= n) {
+            buf[i] = ngx_tolower(h->key.data[i]);
+        }
+
+        key = ngx_hash(key, buf[i]);
+
+        if (names->prefix_lens & ((uint64_t) 1 << i)) {
+            action = ngx_hash_find(&names->prefixes, key, buf, i + 1);
+            if (action) {
+                return action;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Walks r->headers_out.headers exactly once: every header is looked up in
+ * the name table and either hidden, replaced with the managed value, or
+ * dropped as a duplicate.  Managed headers which were not found in the
+ * response are appended afterwards.  entries[] holds the plan entry to
+ * send for each managed header, NULL leaves the header alone.  With clean
+ * set, the walk is skipped, and it is then set if no name matched.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_rewrite(ngx_http_request_t *r, ngx_flag_t hide,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_block_t *block, ngx_uint_t *clean)
+{
+    ngx_uint_t                              i, n, seen, matched, cookies;
+    u_char                                 *value;
+    ngx_list_part_t                        *part, empty;
+    ngx_table_elt_t                        *h;
+    ngx_http_security_headers_ctx_t        *ctx, *prev;
+    ngx_http_security_headers_entry_t      *entry;
+    ngx_http_security_headers_action_t     *action;
+    ngx_http_security_headers_loc_conf_t   *slcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    uint64_t  *counters;
+    u_char     buf[NGX_HTTP_SECURITY_HEADERS_NAME_LEN];
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    counters = smcf->counters;
+    ctx = NULL;
+
+    cookies = (slcf->enable == 1)
+              ? slcf->cookie_flags & NGX_HTTP_SECURITY_HEADERS_COOKIE_FLAGS
+              : 0;
+
+    if (smcf->track) {
+        n = (smcf->hidden.nelts + 63) / 64;
+
+        /*
+         * a context of an earlier pass, such as the one of 103 Early Hints,
+         * is reused if it has the words; the bits are of this pass only
+         */
+
+        prev = ngx_http_get_module_ctx(r, ngx_http_security_headers_module);
+
+        if (prev && prev != &ngx_http_security_headers_done_ctx
+            && prev->words >= n)
+        {
+            ctx = prev;
+
+            ctx->added = 0;
+            ctx->replaced = 0;
+            ctx->removed = 0;
+            ngx_memzero(ctx->hidden, ctx->words * sizeof(uint64_t));
+
+        } else {
+            ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_security_headers_ctx_t)
+                                       + (n ? n - 1 : 0) * sizeof(uint64_t));
+            if (ctx == NULL) {
+                return NGX_ERROR;
+            }
+
+            ctx->words = n;
+
+            if (prev) {
+                ctx->learn = prev->learn;
+            }
+
+            ngx_http_set_ctx(r, ctx, ngx_http_security_headers_module);
+        }
+    }
+
+    seen = 0;
+    matched = 0;
+
+    part = &r->headers_out.headers.part;
+
+    if (clean && *clean) {
+        /* a cached response known to have none of the names */
+
+        ngx_memzero(&empty, sizeof(ngx_list_part_t));
+        part = &empty;
+    }
+
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0) {
+            continue;
+        }
+
+        action = ngx_http_security_headers_lookup(slcf->names, &h[i], buf);
+
+        if (action == NULL) {
+            continue;
+        }
+
+        /* any name keeps the response from being memoized as clean */
+
+        matched++;
+
+        if (action->action == NGX_HTTP_SECURITY_HEADERS_ACTION_COOKIE) {
+            if (cookies == 0) {
+                continue;
+            }
+
+            value = h[i].value.data;
+
+            if (ngx_http_security_headers_cookie_harden(r, &h[i], cookies)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (h[i].value.data != value) {
+                ngx_http_security_headers_probe5(header_replace, r,
+                                                 h[i].key.data, h[i].key.len,
+                                                 h[i].value.data,
+                                                 h[i].value.len);
+            }
+
+            continue;
+        }
+
+        if (action->action == NGX_HTTP_SECURITY_HEADERS_ACTION_HIDE) {
+            if (hide == 1) {
+                ngx_http_security_headers_probe4(header_strip, r,
+                                                 h[i].key.data, h[i].key.len,
+                                                 1);
+
+                h[i].value.len = 0;
+                h[i].hash = 0;
+
+                if (counters) {
+                    counters[NGX_HTTP_SECURITY_HEADERS_STAT_HIDDEN
+                             + action->index]++;
+                }
+
+                if (ctx) {
+                    ctx->hidden[action->index / 64] |=
+                                         (uint64_t) 1 << (action->index % 64);
+                }
+            }
+
+            continue;
+        }
+
+        entry = entries[action->index];
+
+        if (entry == NULL) {
+            continue;
+        }
+
+        if (entry->value.len == 0 || (seen & (1 << action->index))) {
+            ngx_http_security_headers_probe4(header_strip, r,
+                                             h[i].key.data, h[i].key.len, 0);
+
+            h[i].value.len = 0;
+            h[i].hash = 0;
+
+            if (counters) {
+                counters[NGX_HTTP_SECURITY_HEADERS_STAT_REMOVED
+                         + action->index]++;
+            }
+
+            if (ctx) {
+                ctx->removed |= 1 << action->index;
+            }
+
+        } else {
+            ngx_http_security_headers_probe5(header_replace, r,
+                                             h[i].key.data, h[i].key.len,
+                                             entry->value.data,
+                                             entry->value.len);
+
+            h[i].value = entry->value;
+            h[i].hash = 1;
+
+            if (counters) {
+                counters[NGX_HTTP_SECURITY_HEADERS_STAT_REPLACED
+                         + action->index]++;
+            }
+
+            if (ctx) {
+                ctx->replaced |= 1 << action->index;
+            }
+        }
+
+        seen |= 1 << action->index;
+    }
+
+    if (clean) {
+        *clean = (matched == 0);
+    }
+
+    /* usually none of the headers is in the response, send the block */
+
+    if (block && !(block->mask & seen)) {
+
+        if (block->nelts == 0) {
+            return NGX_OK;
+        }
+
+        if (ngx_http_security_headers_splice(r, block) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (counters || ctx
+            || ngx_http_security_headers_probe_enabled(header_add))
+        {
+            for (n = 0; n < NGX_HTTP_SECURITY_HEADERS_MANAGED; n++) {
+                if (entries[n] == NULL || entries[n]->value.len == 0) {
+                    continue;
+                }
+
+                ngx_http_security_headers_probe5(header_add, r,
+                                                 entries[n]->key.data,
+                                                 entries[n]->key.len,
+                                                 entries[n]->value.data,
+                                                 entries[n]->value.len);
+
+                if (counters) {
+                    counters[NGX_HTTP_SECURITY_HEADERS_STAT_ADDED + n]++;
+                }
+
+                if (ctx) {
+                    ctx->added |= 1 << n;
+                }
+            }
+        }
+
+        return NGX_OK;
+    }
+
+    for (n = 0; n < NGX_HTTP_SECURITY_HEADERS_MANAGED; n++) {
+
+        entry = entries[n];
+
+        if (entry == NULL || entry->value.len == 0 || (seen & (1 << n))) {
+            continue;
+        }
+
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = entry->hash;
+        h->key = entry->key;
+        h->value = entry->value;
+        h->lowcase_key = entry->lowcase_key;
+#if (nginx_version >= 1023000)
+        h->next = NULL;
+#endif
+
+        ngx_http_security_headers_probe5(header_add, r,
+                                         entry->key.data, entry->key.len,
+                                         entry->value.data, entry->value.len);
+
+        if (counters) {
+            counters[NGX_HTTP_SECURITY_HEADERS_STAT_ADDED + n]++;
+        }
+
+        if (ctx) {
+            ctx->added |= 1 << n;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Copies the template elements of a block into the last part of the
+ * headers list, or into a new part if they do not fit.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_splice(ngx_http_request_t *r,
+    ngx_http_security_headers_block_t *block)
+{
+    ngx_list_t       *list;
+    ngx_list_part_t  *last;
+
+    list = &r->headers_out.headers;
+    last = list->last;
+
+    if (last->nelts + block->nelts > list->nalloc) {
+
+        if (block->nelts > list->nalloc) {
+            return NGX_ERROR;
+        }
+
+        last = ngx_palloc(r->pool, sizeof(ngx_list_part_t));
+        if (last == NULL) {
+            return NGX_ERROR;
+        }
+
+        last->elts = ngx_palloc(r->pool, list->nalloc * list->size);
+        if (last->elts == NULL) {
+            return NGX_ERROR;
+        }
+
+        last->nelts = 0;
+        last->next = NULL;
+
+        list->last->next = last;
+        list->last = last;
+    }
+
+    ngx_memcpy((ngx_table_elt_t *) last->elts + last->nelts, block->elts,
+               block->nelts * sizeof(ngx_table_elt_t));
+
+    last->nelts += block->nelts;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_SDT)
+
+/* fires filter_entry, and returns the start time for filter_exit */
+
+static uint64_t
+ngx_http_security_headers_probe_start(ngx_http_request_t *r)
+{
+    struct timespec            ts;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_http_security_headers_probe4(filter_entry, r,
+                                     r->headers_out.status,
+                                     clcf->name.data, clcf->name.len);
+
+    if (!ngx_http_security_headers_probe_enabled(filter_exit)) {
+        return 0;
+    }
+
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * fires filter_exit with the class of the response, the number of its
+ * headers, including hidden ones, and the nanoseconds spent in the filter
+ */
+
+static void
+ngx_http_security_headers_probe_exit(ngx_http_request_t *r, ngx_int_t class,
+    uint64_t start)
+{
+    uint64_t                   elapsed;
+    ngx_uint_t                 n;
+    struct timespec            ts;
+    ngx_list_part_t           *part;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    n = 0;
+
+    for (part = &r->headers_out.headers.part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    elapsed = 0;
+
+    if (start) {
+        (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        elapsed = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec - start;
+    }
+
+    ngx_http_security_headers_probe7(filter_exit, r, r->headers_out.status,
+                                     class, n, elapsed,
+                                     clcf->name.data, clcf->name.len);
+}
+
+#endif
+
+
+static void *
+ngx_http_security_headers_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    ngx_uint_t                              i, n;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_security_headers_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->stats_zone = NULL;
+     *     smcf->counters = NULL;
+     *     smcf->upstream_hashes = NULL;
+     *     smcf->policy_zone = NULL;
+     *     smcf->runtime = NULL;
+     */
+
+    n = sizeof(hide_headers) / sizeof(hide_headers[0]);
+
+    if (ngx_array_init(&smcf->hidden, cf->pool, n,
+                       sizeof(ngx_http_security_headers_hidden_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ngx_http_security_headers_hidden(&smcf->hidden, &hide_headers[i], 0)
+            == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    smcf->builtin = n;
+    smcf->stats = NGX_CONF_UNSET;
+    smcf->learn_size = NGX_CONF_UNSET_SIZE;
+
+    if (ngx_array_init(&smcf->policies, cf->pool, 4,
+                       sizeof(ngx_http_security_headers_seed_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
+
+static char *
+ngx_http_security_headers_init_main_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_security_headers_main_conf_t *smcf = conf;
+
+    if (ngx_http_security_headers_init_names(cf, &smcf->names, NULL, NULL)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (smcf->status) {
+        if (smcf->stats == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"security_headers_status\" requires "
+                               "\"security_headers_stats\"");
+            return NGX_CONF_ERROR;
+        }
+
+        smcf->stats = 1;
+    }
+
+    ngx_conf_init_value(smcf->stats, 0);
+    ngx_conf_init_size_value(smcf->learn_size,
+                             NGX_HTTP_SECURITY_HEADERS_LEARN_SIZE);
+
+    if (smcf->stats
+        && ngx_http_security_headers_stats_init_conf(cf, smcf) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (smcf->collector) {
+        if (smcf->report_log == NULL) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"security_headers_report_collector\" "
+                               "requires \"security_headers_report_log\"");
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_http_security_headers_report_init_conf(cf, smcf) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * Builds a names table of the built-in hidden headers, the managed headers
+ * and the optional security_headers_hide and security_headers_hide_prefix
+ * lists.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_init_names(ngx_conf_t *cf,
+    ngx_http_security_headers_names_t *names, ngx_array_t *hide,
+    ngx_array_t *prefixes)
+{
+    ngx_str_t                              *name;
+    ngx_uint_t                              i, k, n, nhide;
+    ngx_array_t                             keys, prefix_keys;
+    ngx_hash_key_t                         *hk;
+    ngx_hash_init_t                         hash;
+    ngx_http_security_headers_action_t     *action;
+    ngx_http_security_headers_hidden_t     *hidden;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    n = sizeof(hide_headers) / sizeof(hide_headers[0]);
+    nhide = hide ? hide->nelts : 0;
+
+    if (ngx_array_init(&keys, cf->temp_pool,
+                       n + nhide + NGX_HTTP_SECURITY_HEADERS_MANAGED + 1,
+                       sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    action = ngx_palloc(cf->pool, NGX_HTTP_SECURITY_HEADERS_MANAGED
+                                  * sizeof(ngx_http_security_headers_action_t));
+    if (action == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(names, sizeof(ngx_http_security_headers_names_t));
+
+    names->min_len = NGX_HTTP_SECURITY_HEADERS_NAME_LEN;
+
+    for (i = 0; i < n + nhide + NGX_HTTP_SECURITY_HEADERS_MANAGED; i++) {
+
+        if (i < NGX_HTTP_SECURITY_HEADERS_MANAGED) {
+            name = &ngx_http_security_headers_managed[i].lowcase_key;
+            action[i].action = NGX_HTTP_SECURITY_HEADERS_ACTION_SET;
+            action[i].index = i;
+
+        } else if (i < NGX_HTTP_SECURITY_HEADERS_MANAGED + n) {
+            hidden = smcf->hidden.elts;
+            hidden = &hidden[i - NGX_HTTP_SECURITY_HEADERS_MANAGED];
+            name = &hidden->name;
+
+        } else {
+            name = &((ngx_str_t *) hide->elts)
+                                   [i - NGX_HTTP_SECURITY_HEADERS_MANAGED - n];
+
+            /* skip the names which are already in the table */
+
+            hk = keys.elts;
+
+            for (k = 0; k < keys.nelts; k++) {
+                if (hk[k].key.len == name->len
+                    && ngx_strncmp(hk[k].key.data, name->data, name->len) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (k < keys.nelts) {
+                continue;
+            }
+
+            hidden = ngx_http_security_headers_hidden(&smcf->hidden, name, 0);
+            if (hidden == NULL) {
+                return NGX_ERROR;
+            }
+        }
+
+        hk = ngx_array_push(&keys);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = *name;
+        hk->key_hash = ngx_hash_key_lc(name->data, name->len);
+        hk->value = (i < NGX_HTTP_SECURITY_HEADERS_MANAGED) ? &action[i]
+                                                             : &hidden->action;
+
+        names->min_len = ngx_min(names->min_len, name->len);
+        names->max_len = ngx_max(names->max_len, name->len);
+        names->first[name->data[0] >> 5] |= 1U << (name->data[0] & 0x1f);
+    }
+
+    /* Set-Cookie for security_headers_cookie_flags, unless it is hidden */
+
+    name = &ngx_http_security_headers_cookie_name;
+    hk = keys.elts;
+
+    for (k = 0; k < keys.nelts; k++) {
+        if (hk[k].key.len == name->len
+            && ngx_strncmp(hk[k].key.data, name->data, name->len) == 0)
+        {
+            break;
+        }
+    }
+
+    if (k == keys.nelts) {
+        hk = ngx_array_push(&keys);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = *name;
+        hk->key_hash = ngx_hash_key_lc(name->data, name->len);
+        hk->value = &ngx_http_security_headers_cookie_action;
+
+        names->min_len = ngx_min(names->min_len, name->len);
+        names->max_len = ngx_max(names->max_len, name->len);
+        names->first[name->data[0] >> 5] |= 1U << (name->data[0] & 0x1f);
+    }
+
+    hash.hash = &names->hash;
+    hash.key = ngx_hash_key_lc;
+    hash.max_size = 2048;
+    hash.bucket_size = ngx_http_security_headers_bucket_size(keys.elts,
+                                                             keys.nelts);
+    hash.name = "security_headers_names_hash";
+    hash.pool = cf->pool;
+    hash.temp_pool = NULL;
+
+    if (ngx_hash_init(&hash, keys.elts, keys.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_security_headers_match_pack(cf, names, keys.elts, keys.nelts)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (prefixes == NULL || prefixes->nelts == 0) {
+        return NGX_OK;
+    }
+
+    if (ngx_array_init(&prefix_keys, cf->temp_pool, prefixes->nelts,
+                       sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    name = prefixes->elts;
+
+    for (i = 0; i < prefixes->nelts; i++) {
+
+        hk = ngx_array_push(&prefix_keys);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hidden = ngx_http_security_headers_hidden(&smcf->hidden, &name[i], 1);
+        if (hidden == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = name[i];
+        hk->key_hash = ngx_hash_key_lc(name[i].data, name[i].len);
+        hk->value = &hidden->action;
+
+        names->prefix_lens |= (uint64_t) 1 << (name[i].len - 1);
+        names->min_len = ngx_min(names->min_len, name[i].len);
+        names->first[name[i].data[0] >> 5] |= 1U << (name[i].data[0] & 0x1f);
+    }
+
+    hash.hash = &names->prefixes;
+    hash.bucket_size = ngx_http_security_headers_bucket_size(prefix_keys.elts,
+                                                             prefix_keys.nelts);
+    hash.name = "security_headers_hide_prefixes_hash";
+
+    if (ngx_hash_init(&hash, prefix_keys.elts, prefix_keys.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * A cache line per bucket, or as much as the longest key takes, so that
+ * ngx_hash_init() takes the header names and content types of any length
+ * the directives accept, without a bucket size directive
+ */
+
+static ngx_uint_t
+ngx_http_security_headers_bucket_size(ngx_hash_key_t *keys, ngx_uint_t n)
+{
+    size_t      size;
+    ngx_uint_t  i;
+
+    size = 64;
+
+    for (i = 0; i < n; i++) {
+        size = ngx_max(size, NGX_HASH_ELT_SIZE(&keys[i]) + sizeof(void *));
+    }
+
+    return ngx_align(size, ngx_cacheline_size);
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_compile_names(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    if (conf->hide == NGX_CONF_UNSET_PTR) {
+        conf->hide = NULL;
+    }
+
+    if (conf->hide_prefixes == NGX_CONF_UNSET_PTR) {
+        conf->hide_prefixes = NULL;
+    }
+
+    if (conf->hide == NULL && conf->hide_prefixes == NULL) {
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                             ngx_http_security_headers_module);
+        conf->names = &smcf->names;
+        return NGX_OK;
+    }
+
+    return ngx_http_security_headers_share(cf, conf,
+                                           NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES);
+}
+
+
+/*
+ * Equal locations share one compiled names table, type map and plan.  The
+ * values a part is compiled from are serialized into a key, which looks
+ * the part up in a table kept while the configuration is parsed: with
+ * thousands of servers, most of them only differ in what this module
+ * does not look at.
+ */
+
+ngx_int_t
+ngx_http_security_headers_share(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf, ngx_uint_t kind)
+{
+    size_t                                  used;
+    uint32_t                                hash;
+    ngx_int_t                               rc;
+    ngx_str_t                               key;
+    ngx_pool_t                             *current;
+    ngx_http_security_headers_share_t      *share;
+    ngx_http_security_headers_shares_t     *shares;
+    ngx_http_security_headers_loc_conf_t   *part;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    shares = smcf->shares;
+
+    if (shares == NULL) {
+        shares = ngx_pcalloc(cf->temp_pool,
+                             sizeof(ngx_http_security_headers_shares_t));
+        if (shares == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&shares->rbtree, &shares->sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        smcf->shares = shares;
+    }
+
+    if (ngx_http_security_headers_share_key(cf, conf, kind, &key) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    hash = ngx_crc32_short(key.data, key.len);
+
+    share = (ngx_http_security_headers_share_t *)
+                ngx_str_rbtree_lookup(&shares->rbtree, &key, hash);
+
+    if (share) {
+        part = share->conf;
+
+        switch (kind) {
+
+        case NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES:
+            conf->hide = part->hide;
+            conf->hide_prefixes = part->hide_prefixes;
+            conf->names = part->names;
+            break;
+
+        case NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES:
+            conf->text_types_keys = part->text_types_keys;
+            conf->type_rules = part->type_rules;
+            conf->types = part->types;
+            break;
+
+        default: /* NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN */
+            conf->plan = part->plan;
+            conf->conditions = part->conditions;
+            conf->typed = part->typed;
+            conf->blocks = part->blocks;
+        }
+
+        shares->shared[kind]++;
+        shares->saved += share->size;
+
+        return NGX_OK;
+    }
+
+    /* the pool allocates from its current block or from new ones */
+
+    current = cf->pool->current;
+    used = ngx_http_security_headers_pool_used(current);
+
+    switch (kind) {
+
+    case NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES:
+        conf->names = ngx_palloc(cf->pool,
+                                 sizeof(ngx_http_security_headers_names_t));
+        if (conf->names == NULL) {
+            return NGX_ERROR;
+        }
+
+        rc = ngx_http_security_headers_init_names(cf, conf->names, conf->hide,
+                                                  conf->hide_prefixes);
+        break;
+
+    case NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES:
+        rc = ngx_http_security_headers_compile_types(cf, conf);
+        break;
+
+    default: /* NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN */
+        rc = ngx_http_security_headers_compile(cf, conf);
+    }
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    share = ngx_palloc(cf->temp_pool, sizeof(ngx_http_security_headers_share_t));
+    if (share == NULL) {
+        return NGX_ERROR;
+    }
+
+    share->sn.node.key = hash;
+    share->sn.str = key;
+    share->conf = conf;
+    share->size = ngx_http_security_headers_pool_used(current) - used;
+
+    ngx_rbtree_insert(&shares->rbtree, &share->sn.node);
+
+    shares->compiled[kind]++;
+
+    return NGX_OK;
+}
+
+
+/*
+ * The key of a part: its kind, then every value the part is compiled from,
+ * with strings prefixed by their length.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_share_key(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf, ngx_uint_t kind,
+    ngx_str_t *key)
+{
+    ngx_str_t                         *str;
+    ngx_uint_t                         i, n;
+    ngx_array_t                        buf, *list;
+    ngx_hash_key_t                    *text;
+    ngx_http_security_headers_type_t  *rule;
+
+    if (ngx_array_init(&buf, cf->temp_pool, 64, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_security_headers_key_add(&buf, &kind, sizeof(ngx_uint_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    switch (kind) {
+
+    case NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES:
+
+        for (n = 0; n < 2; n++) {
+            list = n ? conf->hide_prefixes : conf->hide;
+
+            i = list ? list->nelts : 0;
+
+            if (ngx_http_security_headers_key_add(&buf, &i, sizeof(ngx_uint_t))
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            if (list == NULL) {
+                continue;
+            }
+
+            str = list->elts;
+
+            for (i = 0; i < list->nelts; i++) {
+                if (ngx_http_security_headers_key_str(&buf, &str[i])
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+        }
+
+        break;
+
+    case NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES:
+
+        /* the default text types, "*" or security_headers_text_types */
+
+        if (conf->text_types_keys == NULL) {
+            n = 0;
+
+        } else if (conf->text_types_keys == (void *) -1) {
+            n = 1;
+
+        } else {
+            n = 2 + conf->text_types_keys->nelts;
+        }
+
+        if (ngx_http_security_headers_key_add(&buf, &n, sizeof(ngx_uint_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (n > 1) {
+            text = conf->text_types_keys->elts;
+
+            for (i = 0; i < n - 2; i++) {
+                if (ngx_http_security_headers_key_str(&buf, &text[i].key)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+        }
+
+        if (conf->type_rules == NULL
+            || conf->type_rules == NGX_CONF_UNSET_PTR)
+        {
+            break;
+        }
+
+        rule = conf->type_rules->elts;
+
+        for (i = 0; i < conf->type_rules->nelts; i++) {
+            if (ngx_http_security_headers_key_str(&buf, &rule[i].type)
+                != NGX_OK
+                || ngx_http_security_headers_key_add(&buf, &rule[i].class,
+                                                     sizeof(ngx_uint_t))
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        break;
+
+    default: /* NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN */
+
+        if (ngx_http_security_headers_key_add(&buf, &conf->policy,
+                                    sizeof(ngx_http_security_headers_policy_t))
+            != NGX_OK
+            || ngx_http_security_headers_key_add(&buf, &conf->preserialize,
+                                                 sizeof(ngx_flag_t))
+               != NGX_OK
+            || (conf->report
+                && ngx_http_security_headers_key_str(&buf, &conf->report->url)
+                   != NGX_OK))
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    key->len = buf.nelts;
+    key->data = buf.elts;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_key_add(ngx_array_t *key, void *data, size_t len)
+{
+    u_char  *p;
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    p = ngx_array_push_n(key, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(p, data, len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_key_str(ngx_array_t *key, ngx_str_t *str)
+{
+    if (ngx_http_security_headers_key_add(key, &str->len, sizeof(size_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_security_headers_key_add(key, str->data, str->len);
+}
+
+
+/* Bytes taken from a pool, counting from the given block on */
+
+static size_t
+ngx_http_security_headers_pool_used(ngx_pool_t *pool)
+{
+    size_t  used;
+
+    used = 0;
+
+    for ( /* void */ ; pool; pool = pool->d.next) {
+        used += pool->d.last - (u_char *) pool;
+    }
+
+    return used;
+}
+
+
+static void *
+ngx_http_security_headers_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_security_headers_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_security_headers_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->plan = NULL;
+     *     conf->conditions = 0;
+     *     conf->trust_scheme = 0;
+     *     conf->fetch_allow = 0;
+     *     conf->cookie_flags = 0;
+     *     conf->text_types_keys = NULL;
+     *     conf->types = NULL;
+     *     conf->typed = 0;
+     *     conf->blocks = NULL;
+     *     conf->policy_id = { 0, NULL };
+     *     conf->names = NULL;
+     */
+
+    conf->policy.xss =    NGX_CONF_UNSET_UINT;
+    conf->policy.fo  =    NGX_CONF_UNSET_UINT;
+    conf->policy.rp  =    NGX_CONF_UNSET_UINT;
+    conf->policy.corp =   NGX_CONF_UNSET_UINT;
+    conf->policy.coop =   NGX_CONF_UNSET_UINT;
+    conf->policy.coep =   NGX_CONF_UNSET_UINT;
+    conf->enable = NGX_CONF_UNSET;
+    conf->hide_server_tokens = NGX_CONF_UNSET_UINT;
+    conf->subrequests = NGX_CONF_UNSET;
+    conf->trusted = NGX_CONF_UNSET_PTR;
+    conf->type_rules = NGX_CONF_UNSET_PTR;
+    conf->hide = NGX_CONF_UNSET_PTR;
+    conf->hide_prefixes = NGX_CONF_UNSET_PTR;
+    conf->hide_upstream = NGX_CONF_UNSET;
+    conf->cache = NGX_CONF_UNSET;
+    conf->preserialize = NGX_CONF_UNSET;
+    conf->policy_index = NGX_CONF_UNSET_UINT;
+    conf->csp_learn = NGX_CONF_UNSET_UINT;
+    conf->fetch_isolation = NGX_CONF_UNSET_UINT;
+    conf->csp_nonce = NGX_CONF_UNSET;
+    conf->host_map = NGX_CONF_UNSET_PTR;
+    conf->report = NGX_CONF_UNSET_PTR;
+    conf->policy.hsts_preload = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_security_headers_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child)
+{
+    ngx_http_security_headers_loc_conf_t *prev = parent;
+    ngx_http_security_headers_loc_conf_t *conf = child;
+
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    ngx_conf_merge_value(conf->enable, prev->enable, 0);
+    ngx_conf_merge_value(conf->hide_server_tokens, prev->hide_server_tokens, 0);
+    ngx_conf_merge_value(conf->subrequests, prev->subrequests, 0);
+    ngx_conf_merge_value(conf->policy.hsts_preload,
+                         prev->policy.hsts_preload, 1);
+
+    if (conf->hide == NGX_CONF_UNSET_PTR
+        && conf->hide_prefixes == NGX_CONF_UNSET_PTR)
+    {
+        if (prev->names == NULL
+            && ngx_http_security_headers_compile_names(cf, prev) != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        conf->hide = prev->hide;
+        conf->hide_prefixes = prev->hide_prefixes;
+        conf->names = prev->names;
+
+    } else {
+        ngx_conf_merge_ptr_value(conf->hide, prev->hide, NULL);
+        ngx_conf_merge_ptr_value(conf->hide_prefixes, prev->hide_prefixes,
+                                 NULL);
+
+        if (ngx_http_security_headers_compile_names(cf, conf) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    ngx_conf_merge_value(conf->hide_upstream, prev->hide_upstream, 0);
+
+    if (conf->hide_upstream == 1
+        && conf->hide_server_tokens == 1
+        && ngx_http_security_headers_upstream_hide(cf, conf) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->text_types_keys == NULL && conf->type_rules == NGX_CONF_UNSET_PTR)
+    {
+        /* share the map of the enclosing level */
+
+        if (prev->types == NULL
+            && ngx_http_security_headers_share(cf, prev,
+                                       NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES)
+               != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        conf->text_types_keys = prev->text_types_keys;
+        conf->type_rules = prev->type_rules;
+        conf->types = prev->types;
+
+    } else {
+
+        if (conf->text_types_keys == NULL) {
+            conf->text_types_keys = prev->text_types_keys;
+        }
+
+        ngx_conf_merge_ptr_value(conf->type_rules, prev->type_rules, NULL);
+
+        if (ngx_http_security_headers_share(cf, conf,
+                                       NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES)
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    ngx_conf_merge_uint_value(conf->policy.xss, prev->policy.xss,
+                              NGX_HTTP_XSS_HEADER_UNSET);
+    ngx_conf_merge_uint_value(conf->policy.fo, prev->policy.fo,
+                              NGX_HTTP_FO_HEADER_SAME);
+    ngx_conf_merge_uint_value(conf->policy.rp, prev->policy.rp,
+                              NGX_HTTP_RP_HEADER_STRICT_ORIG_WHEN_CROSS);
+
+    /* CORP defaults to same-site (opt-out), COOP/COEP default to omit (opt-in) */
+    ngx_conf_merge_uint_value(conf->policy.corp, prev->policy.corp,
+                              NGX_HTTP_CORP_HEADER_SAME_SITE);
+    ngx_conf_merge_uint_value(conf->policy.coop, prev->policy.coop,
+                              NGX_HTTP_SECURITY_HEADER_OMIT);
+    ngx_conf_merge_uint_value(conf->policy.coep, prev->policy.coep,
+                              NGX_HTTP_SECURITY_HEADER_OMIT);
+
+    ngx_conf_merge_ptr_value(conf->trusted, prev->trusted, NULL);
+    ngx_conf_merge_bitmask_value(conf->trust_scheme, prev->trust_scheme,
+                                 (NGX_CONF_BITMASK_SET
+                                  |NGX_HTTP_SECURITY_HEADERS_TRUST_OFF));
+    ngx_conf_merge_bitmask_value(conf->cookie_flags, prev->cookie_flags,
+                                 (NGX_CONF_BITMASK_SET
+                                  |NGX_HTTP_SECURITY_HEADERS_COOKIE_OFF));
+
+    ngx_conf_merge_uint_value(conf->fetch_isolation, prev->fetch_isolation,
+                              NGX_HTTP_SECURITY_HEADERS_FETCH_OFF);
+    ngx_conf_merge_bitmask_value(conf->fetch_allow, prev->fetch_allow,
+                                 NGX_CONF_BITMASK_SET);
+
+    if (conf->enable == 1
+        && conf->fetch_isolation != NGX_HTTP_SECURITY_HEADERS_FETCH_OFF)
+    {
+        ngx_http_security_headers_fetch_compile(conf);
+
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+        smcf->fetch = 1;
+    }
+
+    ngx_conf_merge_value(conf->preserialize, prev->preserialize, 0);
+    ngx_conf_merge_value(conf->cache, prev->cache, 0);
+
+    if (conf->enable == 1 && conf->cache == 1) {
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+        smcf->cache = 1;
+    }
+
+    ngx_conf_merge_uint_value(conf->csp_learn, prev->csp_learn,
+                              NGX_HTTP_SECURITY_HEADERS_LEARN_OFF);
+
+    if (conf->enable == 1
+        && conf->csp_learn != NGX_HTTP_SECURITY_HEADERS_LEARN_OFF)
+    {
+#if (NGX_OPENSSL)
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+        smcf->learn = 1;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"security_headers_csp_learn\" requires nginx "
+                           "built with OpenSSL");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_merge_value(conf->csp_nonce, prev->csp_nonce, 0);
+
+    if (conf->enable == 1 && conf->csp_nonce == 1) {
+#if (NGX_OPENSSL)
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+        smcf->nonce = 1;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"security_headers_csp_nonce\" requires nginx "
+                           "built with OpenSSL");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    ngx_conf_merge_str_value(conf->policy_id, prev->policy_id, "");
+    ngx_conf_merge_ptr_value(conf->report, prev->report, NULL);
+
+    if (conf->enable == 1
+        && conf->policy_id.len
+        && ngx_http_security_headers_policy_register(cf, conf) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (conf->enable == 1
+        && ngx_http_security_headers_share(cf, conf,
+                                           NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN)
+           != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_conf_merge_ptr_value(conf->host_map, prev->host_map, NULL);
+
+    if (conf->enable == 1 && conf->host_map
+        && ngx_http_security_headers_host_compile(cf, conf) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+#if (nginx_version >= 1029000)
+    if (conf->enable == 1
+        && ngx_http_security_headers_interim(cf, conf) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+#endif
+
+    /* pick the filter variant, the filter is installed only if one is used */
+
+    if (conf->enable == 1) {
+        conf->handler = (conf->hide_server_tokens == 1)
+                        ? ngx_http_security_headers_filter_full
+                        : ngx_http_security_headers_filter_headers;
+
+    } else if (conf->hide_server_tokens == 1) {
+        conf->handler = ngx_http_security_headers_filter_hide;
+
+    } else {
+        conf->handler = ngx_http_security_headers_filter_pass;
+    }
+
+    if (conf->handler != ngx_http_security_headers_filter_pass) {
+        smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+        smcf->used = 1;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * Builds the plan of a location: the headers it may send, with their values,
+ * lowercased keys and hashes, and the response conditions to send them under.
+ * This is the only place which decides what the module sends.
+ */
+
+ngx_int_t
+ngx_http_security_headers_compile(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    ngx_str_t                           *coop, *coep, *sandbox;
+    ngx_uint_t                           i, classes;
+    ngx_array_t                         *plan;
+    ngx_http_security_headers_entry_t   *entry;
+    ngx_http_security_headers_policy_t  *policy;
+    ngx_http_security_headers_report_t  *report;
+
+    policy = &conf->policy;
+    report = conf->report;
+
+    if (report) {
+        coop = ngx_http_security_headers_coop_reported;
+        coep = ngx_http_security_headers_coep_reported;
+        sandbox = &ngx_http_security_headers_sandbox_reported;
+
+    } else {
+        coop = ngx_http_security_headers_coop_values;
+        coep = ngx_http_security_headers_coep_values;
+        sandbox = &ngx_http_security_headers_sandbox_value;
+    }
+
+    plan = ngx_array_create(cf->pool, NGX_HTTP_SECURITY_HEADERS_MANAGED,
+                            sizeof(ngx_http_security_headers_entry_t));
+    if (plan == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* X-Content-Type-Options is sent for all types */
+    if (ngx_http_security_headers_add_entry(plan,
+            NGX_HTTP_SECURITY_HEADERS_XCTO,
+            &ngx_http_security_headers_xcto_value,
+            NGX_HTTP_SECURITY_HEADERS_IF_OK,
+            NGX_HTTP_SECURITY_HEADERS_CLASS_ALL)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (policy->xss != NGX_HTTP_SECURITY_HEADER_OMIT) {
+
+        /* the deprecated header is removed regardless of the type */
+
+        classes = (policy->xss == NGX_HTTP_XSS_HEADER_UNSET)
+                  ? NGX_HTTP_SECURITY_HEADERS_CLASS_FULL
+                  : NGX_HTTP_SECURITY_HEADERS_CLASS(
+                                        NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT);
+
+        if (ngx_http_security_headers_add_entry(plan,
+                NGX_HTTP_SECURITY_HEADERS_XSS,
+                &ngx_http_security_headers_xss_values[policy->xss],
+                NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED, classes)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (ngx_http_security_headers_add_entry(plan,
+            NGX_HTTP_SECURITY_HEADERS_HSTS,
+            &ngx_http_security_headers_hsts_values[policy->hsts_preload ? 1 : 0],
+            NGX_HTTP_SECURITY_HEADERS_IF_HTTPS,
+            NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (policy->fo != NGX_HTTP_SECURITY_HEADER_OMIT
+        && ngx_http_security_headers_add_entry(plan,
+               NGX_HTTP_SECURITY_HEADERS_FO,
+               &ngx_http_security_headers_fo_values[policy->fo],
+               NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+               NGX_HTTP_SECURITY_HEADERS_CLASS(
+                                        NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT))
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (policy->rp != NGX_HTTP_SECURITY_HEADER_OMIT
+        && ngx_http_security_headers_add_entry(plan,
+               NGX_HTTP_SECURITY_HEADERS_RP,
+               &ngx_http_security_headers_rp_values[policy->rp],
+               NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+               NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (policy->corp != NGX_HTTP_SECURITY_HEADER_OMIT
+        && ngx_http_security_headers_add_entry(plan,
+               NGX_HTTP_SECURITY_HEADERS_CORP,
+               &ngx_http_security_headers_corp_values[policy->corp],
+               NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+               NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (policy->coop != NGX_HTTP_SECURITY_HEADER_OMIT
+        && ngx_http_security_headers_add_entry(plan,
+               NGX_HTTP_SECURITY_HEADERS_COOP,
+               &coop[policy->coop],
+               NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+               NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (policy->coep != NGX_HTTP_SECURITY_HEADER_OMIT
+        && ngx_http_security_headers_add_entry(plan,
+               NGX_HTTP_SECURITY_HEADERS_COEP,
+               &coep[policy->coep],
+               NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+               NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /* active content, e.g. PDF, is isolated with a sandbox CSP */
+    if (ngx_http_security_headers_add_entry(plan,
+            NGX_HTTP_SECURITY_HEADERS_CSP,
+            sandbox,
+            NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+            NGX_HTTP_SECURITY_HEADERS_CLASS(
+                                        NGX_HTTP_SECURITY_HEADERS_TYPE_SANDBOX))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /* the endpoint, under both the current and the deprecated header */
+    if (report
+        && (ngx_http_security_headers_add_entry(plan,
+                NGX_HTTP_SECURITY_HEADERS_REPORTING, &report->endpoints,
+                NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+                NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+            != NGX_OK
+            || ngx_http_security_headers_add_entry(plan,
+                   NGX_HTTP_SECURITY_HEADERS_REPORT_TO, &report->report_to,
+                   NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED,
+                   NGX_HTTP_SECURITY_HEADERS_CLASS_FULL)
+               != NGX_OK))
+    {
+        return NGX_ERROR;
+    }
+
+    conf->plan = plan;
+    conf->conditions = 0;
+    conf->typed = 0;
+
+    entry = plan->elts;
+
+    for (i = 0; i < plan->nelts; i++) {
+        conf->conditions |= entry[i].conditions;
+
+        if (entry[i].classes != NGX_HTTP_SECURITY_HEADERS_CLASS_ALL) {
+            conf->typed = 1;
+        }
+    }
+
+    if (conf->preserialize == 1) {
+        return ngx_http_security_headers_serialize(cf, conf);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Serializes the headers appended for every content type class and every
+ * combination of response conditions, the same selection the filter does.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_serialize(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    ngx_uint_t                          i, class, mask;
+    ngx_http_security_headers_block_t  *block;
+    ngx_http_security_headers_entry_t  *entry;
+
+    ngx_http_security_headers_entry_t  *entries[NGX_HTTP_SECURITY_HEADERS_MANAGED];
+
+    conf->blocks = ngx_pcalloc(cf->pool,
+                               NGX_HTTP_SECURITY_HEADERS_TYPES
+                               * (NGX_HTTP_SECURITY_HEADERS_IF_ALL + 1)
+                               * sizeof(ngx_http_security_headers_block_t));
+    if (conf->blocks == NULL) {
+        return NGX_ERROR;
+    }
+
+    entry = conf->plan->elts;
+    block = conf->blocks;
+
+    for (class = 0; class < NGX_HTTP_SECURITY_HEADERS_TYPES; class++) {
+        for (mask = 0; mask <= NGX_HTTP_SECURITY_HEADERS_IF_ALL; mask++) {
+
+            ngx_memzero(entries, sizeof(entries));
+
+            for (i = 0; i < conf->plan->nelts; i++) {
+                if ((entry[i].conditions & ~mask)
+                    || !(entry[i].classes
+                         & NGX_HTTP_SECURITY_HEADERS_CLASS(class)))
+                {
+                    continue;
+                }
+
+                entries[entry[i].index] = &entry[i];
+            }
+
+            if (ngx_http_security_headers_block(cf, entries, block++)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/* Serializes the headers of one block, entries[] as in the filter */
+
+static ngx_int_t
+ngx_http_security_headers_block(ngx_conf_t *cf,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_block_t *block)
+{
+    ngx_uint_t        n;
+    ngx_table_elt_t  *h;
+
+    for (n = 0; n < NGX_HTTP_SECURITY_HEADERS_MANAGED; n++) {
+        if (entries[n] == NULL) {
+            continue;
+        }
+
+        /* a header to remove must be looked for in the response */
+
+        block->mask |= 1 << n;
+
+        if (entries[n]->value.len) {
+            block->nelts++;
+        }
+    }
+
+    if (block->nelts == 0) {
+        return NGX_OK;
+    }
+
+    block->elts = ngx_palloc(cf->pool, block->nelts * sizeof(ngx_table_elt_t));
+    if (block->elts == NULL) {
+        return NGX_ERROR;
+    }
+
+    h = block->elts;
+
+    for (n = 0; n < NGX_HTTP_SECURITY_HEADERS_MANAGED; n++) {
+        if (entries[n] == NULL || entries[n]->value.len == 0) {
+            continue;
+        }
+
+        h->hash = entries[n]->hash;
+        h->key = entries[n]->key;
+        h->value = entries[n]->value;
+        h->lowcase_key = entries[n]->lowcase_key;
+#if (nginx_version >= 1023000)
+        h->next = NULL;
+#endif
+
+        h++;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (nginx_version >= 1029000)
+
+/*
+ * The 103 Early Hints block.  Early hints precede navigations, so the
+ * headers are those of a text/html response of the location.
+ */
+
+ngx_int_t
+ngx_http_security_headers_interim(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    ngx_uint_t                          i, class;
+    ngx_http_security_headers_entry_t  *entry;
+
+    ngx_http_security_headers_entry_t  *entries[NGX_HTTP_SECURITY_HEADERS_MANAGED];
+
+    conf->interim_class = conf->typed
+                          ? ngx_http_security_headers_type_class(conf->types,
+                                (u_char *) "text/html", sizeof("text/html") - 1,
+                                ngx_hash_key((u_char *) "text/html",
+                                             sizeof("text/html") - 1))
+                          : NGX_HTTP_SECURITY_HEADERS_TYPE_STANDARD;
+
+    conf->interim = ngx_pcalloc(cf->pool,
+                                sizeof(ngx_http_security_headers_block_t));
+    if (conf->interim == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(entries, sizeof(entries));
+
+    class = NGX_HTTP_SECURITY_HEADERS_CLASS(conf->interim_class);
+    entry = conf->plan->elts;
+
+    for (i = 0; i < conf->plan->nelts; i++) {
+        if (!(NGX_HTTP_SECURITY_HEADERS_INTERIM & (1 << entry[i].index))
+            || (entry[i].conditions & ~NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED)
+            || !(entry[i].classes & class))
+        {
+            continue;
+        }
+
+        entries[entry[i].index] = &entry[i];
+    }
+
+    return ngx_http_security_headers_block(cf, entries, conf->interim);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_security_headers_add_entry(ngx_array_t *plan, ngx_uint_t index,
+    ngx_str_t *value, ngx_uint_t conditions, ngx_uint_t classes)
+{
+    ngx_http_security_headers_name_t   *name;
+    ngx_http_security_headers_entry_t  *entry;
+
+    name = &ngx_http_security_headers_managed[index];
+
+    entry = ngx_array_push(plan);
+    if (entry == NULL) {
+        return NGX_ERROR;
+    }
+
+    entry->key = name->key;
+    entry->value = *value;
+    entry->lowcase_key = name->lowcase_key.data;
+    entry->hash = ngx_hash_key(name->lowcase_key.data, name->lowcase_key.len);
+    entry->index = index;
+    entry->conditions = conditions;
+    entry->classes = classes;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Compiles security_headers_text_types, which are "document" types, and
+ * security_headers_types on top of them into an exact hash and a list of
+ * wildcards ordered from the most specific one.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_compile_types(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    u_char                                *star;
+    ngx_str_t                             *type;
+    ngx_uint_t                             i, n;
+    ngx_array_t                            keys, *rules;
+    ngx_hash_key_t                        *hk, *text, *exact;
+    ngx_hash_init_t                        hash;
+    ngx_http_security_headers_type_t      *rule;
+    ngx_http_security_headers_types_t     *types;
+    ngx_http_security_headers_wildcard_t  *wc;
+
+    types = ngx_pcalloc(cf->pool, sizeof(ngx_http_security_headers_types_t));
+    if (types == NULL) {
+        return NGX_ERROR;
+    }
+
+    types->default_class = NGX_HTTP_SECURITY_HEADERS_TYPE_STANDARD;
+
+    if (ngx_array_init(&keys, cf->temp_pool, 8, sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (conf->text_types_keys == (void *) -1) {
+        types->default_class = NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT;
+
+    } else if (conf->text_types_keys) {
+        text = conf->text_types_keys->elts;
+
+        for (i = 0; i < conf->text_types_keys->nelts; i++) {
+            hk = ngx_array_push(&keys);
+            if (hk == NULL) {
+                return NGX_ERROR;
+            }
+
+            hk->key = text[i].key;
+            hk->key_hash = text[i].key_hash;
+            hk->value = (void *) (NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT + 1);
+        }
+
+    } else {
+        for (type = ngx_http_security_headers_default_text_types;
+             type->len;
+             type++)
+        {
+            hk = ngx_array_push(&keys);
+            if (hk == NULL) {
+                return NGX_ERROR;
+            }
+
+            hk->key = *type;
+            hk->key_hash = ngx_hash_key_lc(type->data, type->len);
+            hk->value = (void *) (NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT + 1);
+        }
+    }
+
+    rules = (conf->type_rules == NGX_CONF_UNSET_PTR) ? NULL : conf->type_rules;
+
+    if (rules) {
+        rule = rules->elts;
+
+        for (i = 0; i < rules->nelts; i++) {
+
+            star = ngx_strlchr(rule[i].type.data,
+                               rule[i].type.data + rule[i].type.len, '*');
+
+            if (star == NULL) {
+
+                /* a later exact type overrides the text types */
+
+                hk = keys.elts;
+                exact = NULL;
+
+                for (n = 0; n < keys.nelts; n++) {
+                    if (hk[n].key.len == rule[i].type.len
+                        && ngx_strncmp(hk[n].key.data, rule[i].type.data,
+                                       rule[i].type.len)
+                           == 0)
+                    {
+                        exact = &hk[n];
+                        break;
+                    }
+                }
+
+                if (exact == NULL) {
+                    exact = ngx_array_push(&keys);
+                    if (exact == NULL) {
+                        return NGX_ERROR;
+                    }
+
+                    exact->key = rule[i].type;
+                    exact->key_hash = ngx_hash_key(rule[i].type.data,
+                                                   rule[i].type.len);
+                }
+
+                exact->value = (void *) (rule[i].class + 1);
+                continue;
+            }
+
+            if (rule[i].type.len == 1) {
+                types->default_class = rule[i].class;
+                continue;
+            }
+
+            if (types->wildcards == NULL) {
+                types->wildcards = ngx_array_create(cf->pool, 4,
+                                       sizeof(ngx_http_security_headers_wildcard_t));
+                if (types->wildcards == NULL) {
+                    return NGX_ERROR;
+                }
+            }
+
+            wc = ngx_array_push(types->wildcards);
+            if (wc == NULL) {
+                return NGX_ERROR;
+            }
+
+            wc->prefix.data = rule[i].type.data;
+            wc->prefix.len = star - rule[i].type.data;
+            wc->suffix.data = star + 1;
+            wc->suffix.len = rule[i].type.data + rule[i].type.len - (star + 1);
+            wc->class = rule[i].class;
+        }
+    }
+
+    if (types->wildcards) {
+        ngx_sort(types->wildcards->elts, types->wildcards->nelts,
+                 sizeof(ngx_http_security_headers_wildcard_t),
+                 ngx_http_security_headers_cmp_wildcards);
+    }
+
+    hash.hash = &types->exact;
+    hash.key = ngx_hash_key_lc;
+    hash.max_size = 2048;
+    hash.bucket_size = ngx_http_security_headers_bucket_size(keys.elts,
+                                                             keys.nelts);
+    hash.name = "security_headers_types_hash";
+    hash.pool = cf->pool;
+    hash.temp_pool = NULL;
+
+    if (ngx_hash_init(&hash, keys.elts, keys.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    conf->types = types;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_cmp_wildcards(const void *one, const void *two)
+{
+    ngx_http_security_headers_wildcard_t  *first, *second;
+
+    first = (ngx_http_security_headers_wildcard_t *) one;
+    second = (ngx_http_security_headers_wildcard_t *) two;
+
+    return (ngx_int_t) (second->prefix.len + second->suffix.len)
+           - (ngx_int_t) (first->prefix.len + first->suffix.len);
+}
+
+
+static char *
+ngx_http_security_headers_types(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char  *p = conf;
+
+    u_char                            *star;
+    ngx_str_t                         *value;
+    ngx_uint_t                         i, class;
+    ngx_array_t                      **rules;
+    ngx_conf_enum_t                   *e;
+    ngx_http_security_headers_type_t  *rule;
+
+    rules = (ngx_array_t **) (p + cmd->offset);
+    value = cf->args->elts;
+
+    e = ngx_http_security_headers_type_classes;
+
+    for (i = 0; e[i].name.len; i++) {
+        if (e[i].name.len == value[1].len
+            && ngx_strcmp(e[i].name.data, value[1].data) == 0)
+        {
+            break;
+        }
+    }
+
+    if (e[i].name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid type class \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    class = e[i].value;
+
+    if (*rules == NGX_CONF_UNSET_PTR) {
+        *rules = ngx_array_create(cf->pool, 4,
+                                  sizeof(ngx_http_security_headers_type_t));
+        if (*rules == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        star = ngx_strlchr(value[i].data, value[i].data + value[i].len, '*');
+
+        if (star
+            && ngx_strlchr(star + 1, value[i].data + value[i].len, '*'))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "only one \"*\" is allowed in \"%V\"",
+                               &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_strlow(value[i].data, value[i].data, value[i].len);
+
+        rule = ngx_array_push(*rules);
+        if (rule == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        rule->type = value[i];
+        rule->class = class;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_security_headers_hide(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    char  *p = conf;
+
+    u_char                                  c;
+    ngx_str_t                              *value, *name;
+    ngx_uint_t                              i, n, prefix;
+    ngx_array_t                           **names;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    names = (ngx_array_t **) (p + cmd->offset);
+    value = cf->args->elts;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    prefix = (cmd->name.len == sizeof("security_headers_hide_prefix") - 1);
+
+    if (*names == NGX_CONF_UNSET_PTR) {
+        *names = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                  sizeof(ngx_str_t));
+        if (*names == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (prefix && value[i].len && value[i].data[value[i].len - 1] == '*') {
+            value[i].len--;
+        }
+
+        if (value[i].len == 0
+            || value[i].len > NGX_HTTP_SECURITY_HEADERS_NAME_LEN)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid header name \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_strlow(value[i].data, value[i].data, value[i].len);
+
+        for (n = 0; n < value[i].len; n++) {
+            c = value[i].data[n];
+
+            if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+                || c == '-' || c == '_')
+            {
+                continue;
+            }
+
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid header name \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        for (n = 0; n < NGX_HTTP_SECURITY_HEADERS_MANAGED; n++) {
+            name = &ngx_http_security_headers_managed[n].lowcase_key;
+
+            if (!prefix
+                && name->len == value[i].len
+                && ngx_strncmp(name->data, value[i].data, value[i].len) == 0)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "header \"%V\" is managed by the module",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        if (ngx_http_security_headers_hidden(&smcf->hidden, &value[i], prefix)
+            == NULL)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        name = ngx_array_push(*names);
+        if (name == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *name = value[i];
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * Finds or registers a hidden name.  All the names are registered while
+ * the configuration is parsed, so that each one has a counter and the
+ * actions are not moved once the names tables point to them.
+ */
+
+static ngx_http_security_headers_hidden_t *
+ngx_http_security_headers_hidden(ngx_array_t *hidden, ngx_str_t *name,
+    ngx_uint_t prefix)
+{
+    ngx_uint_t                           i;
+    ngx_http_security_headers_hidden_t  *h;
+
+    h = hidden->elts;
+
+    for (i = 0; i < hidden->nelts; i++) {
+        if (h[i].prefix == prefix
+            && h[i].name.len == name->len
+            && ngx_strncmp(h[i].name.data, name->data, name->len) == 0)
+        {
+            return &h[i];
+        }
+    }
+
+    h = ngx_array_push(hidden);
+    if (h == NULL) {
+        return NULL;
+    }
+
+    h->name = *name;
+    h->prefix = prefix;
+    h->action.action = NGX_HTTP_SECURITY_HEADERS_ACTION_HIDE;
+    h->action.index = hidden->nelts - 1;
+
+    return h;
+}
+
+
+static char *
+ngx_http_security_headers_trust_from(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_security_headers_loc_conf_t *slcf = conf;
+
+    ngx_int_t                             rc;
+    ngx_str_t                            *value;
+    ngx_cidr_t                            cidr;
+    ngx_http_security_headers_trusted_t  *trusted;
+
+    value = cf->args->elts;
+
+    if (slcf->trusted == NGX_CONF_UNSET_PTR) {
+        slcf->trusted = ngx_pcalloc(cf->pool,
+                                    sizeof(ngx_http_security_headers_trusted_t));
+        if (slcf->trusted == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    trusted = slcf->trusted;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+    if (ngx_strcmp(value[1].data, "unix:") == 0) {
+        trusted->unix_domain = 1;
+        return NGX_CONF_OK;
+    }
+
+#endif
+
+    rc = ngx_ptocidr(&value[1], &cidr);
+
+    if (rc == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (rc == NGX_DONE) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "low address bits of %V are meaningless", &value[1]);
+    }
+
+    switch (cidr.family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        if (trusted->tree6 == NULL) {
+            trusted->tree6 = ngx_radix_tree_create(cf->pool, -1);
+            if (trusted->tree6 == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        rc = ngx_radix128tree_insert(trusted->tree6,
+                                     cidr.u.in6.addr.s6_addr,
+                                     cidr.u.in6.mask.s6_addr, 1);
+        break;
+#endif
+
+    default: /* AF_INET */
+        if (trusted->tree == NULL) {
+            trusted->tree = ngx_radix_tree_create(cf->pool, -1);
+            if (trusted->tree == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        rc = ngx_radix32tree_insert(trusted->tree, ntohl(cidr.u.in.addr),
+                                    ntohl(cidr.u.in.mask), 1);
+        break;
+    }
+
+    /* NGX_BUSY is a duplicate network, harmless here */
+
+    if (rc == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var, *v;
+
+    for (v = ngx_http_security_headers_vars; v->name.len; v++) {
+        var = ngx_http_add_variable(cf, &v->name, v->flags);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = v->get_handler;
+        var->data = v->data;
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Turns the bits recorded by the filter into a comma separated list of
+ * lowercased names.  $security_headers_stripped lists the managed headers
+ * removed from the response, then the hidden ones.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                                 *p;
+    size_t                                  len;
+    uint32_t                                bits;
+    ngx_str_t                              *name;
+    ngx_uint_t                              i, n;
+    ngx_http_security_headers_ctx_t        *ctx;
+    ngx_http_security_headers_hidden_t     *hidden;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_security_headers_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    bits = *(uint32_t *) ((char *) ctx + data);
+
+    hidden = smcf->hidden.elts;
+    n = 0;
+
+    /*
+     * only a context of the filter holds the hidden names: one made for
+     * csp_learn or to mark the headers done has no words
+     */
+
+    if (data == offsetof(ngx_http_security_headers_ctx_t, removed)) {
+        n = ngx_min(smcf->hidden.nelts, ctx->words * 64);
+    }
+
+    len = 0;
+
+    for (i = 0; i < NGX_HTTP_SECURITY_HEADERS_MANAGED; i++) {
+        if (bits & (1 << i)) {
+            len += ngx_http_security_headers_managed[i].lowcase_key.len + 1;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ctx->hidden[i / 64] & ((uint64_t) 1 << (i % 64))) {
+            len += hidden[i].name.len + 1;
+        }
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+
+    if (len == 0) {
+        v->len = 0;
+        v->data = (u_char *) "";
+        return NGX_OK;
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+
+    for (i = 0; i < NGX_HTTP_SECURITY_HEADERS_MANAGED; i++) {
+        if (bits & (1 << i)) {
+            name = &ngx_http_security_headers_managed[i].lowcase_key;
+            p = ngx_cpymem(p, name->data, name->len);
+            *p++ = ',';
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ctx->hidden[i / 64] & ((uint64_t) 1 << (i % 64))) {
+            p = ngx_cpymem(p, hidden[i].name.data, hidden[i].name.len);
+            *p++ = ',';
+        }
+    }
+
+    v->len = len - 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                              i;
+    ngx_http_variable_t                    *v, *var;
+    ngx_http_core_main_conf_t              *cmcf;
+    ngx_http_security_headers_shares_t     *shares;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    shares = smcf->shares;
+
+    if (shares) {
+        ngx_log_debug7(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                       "security headers: %ui plans, %ui type maps, "
+                       "%ui names tables compiled, %ui, %ui and %ui "
+                       "shared, %uz bytes saved",
+                       shares->compiled[NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN],
+                       shares->compiled[NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES],
+                       shares->compiled[NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES],
+                       shares->shared[NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN],
+                       shares->shared[NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES],
+                       shares->shared[NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES],
+                       shares->saved);
+
+        /* the table is in the temporary pool */
+
+        smcf->shares = NULL;
+    }
+
+    if (smcf->policies.nelts
+        && ngx_http_security_headers_policy_init_conf(cf, smcf) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    /*
+     * The variables are indexed while the configuration is parsed, the
+     * filter records its work only if one of them is referred to
+     */
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    v = cmcf->variables.elts;
+
+    for (i = 0; i < cmcf->variables.nelts; i++) {
+        for (var = ngx_http_security_headers_vars; var->name.len; var++) {
+            if (var->get_handler == ngx_http_security_headers_variable
+                && v[i].name.len == var->name.len
+                && ngx_strncmp(v[i].name.data, var->name.data, var->name.len)
+                   == 0)
+            {
+                smcf->track = 1;
+            }
+        }
+    }
+
+    if (!smcf->used) {
+        return NGX_OK;
+    }
+
+#if (NGX_OPENSSL)
+    if ((smcf->learn || smcf->nonce)
+        && ngx_http_security_headers_learn_init_conf(cf, smcf) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+#endif
+
+    if (smcf->fetch && ngx_http_security_headers_fetch_init(cf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_security_headers_match_init(cf->log);
+
+    /* install handler in header filter chain */
+
+    ngx_http_next_header_filter = ngx_http_top_header_filter;
+    ngx_http_top_header_filter = ngx_http_security_headers_filter;
+
+#if (nginx_version >= 1029000)
+    ngx_http_next_early_hints_filter = ngx_http_top_early_hints_filter;
+    ngx_http_top_early_hints_filter =
+                                ngx_http_security_headers_early_hints_filter;
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_init_module(ngx_cycle_t *cycle)
+{
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_security_headers_module);
+
+    if (smcf == NULL || smcf->stats_zone == NULL) {
+        return NGX_OK;
+    }
+
+    return ngx_http_security_headers_stats_init_module(cycle, smcf);
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_init_process(ngx_cycle_t *cycle)
+{
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_security_headers_module);
+
+    if (smcf && smcf->stats_zone) {
+        ngx_http_security_headers_stats_init_process(cycle, smcf);
+    }
+
+    if (smcf && smcf->report_zone
+        && ngx_http_security_headers_report_init_process(cycle, smcf)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HTTP_CACHE)
+    if (smcf && smcf->cache
+        && ngx_http_security_headers_cache_init_process(cycle, smcf) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_security_headers_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_security_headers_module);
+
+    if (smcf && smcf->report_zone) {
+        ngx_http_security_headers_report_exit_process(cycle, smcf);
+    }
+}
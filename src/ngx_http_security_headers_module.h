@@ -0,0 +1,626 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#ifndef _NGX_HTTP_SECURITY_HEADERS_MODULE_H_INCLUDED_
+#define _NGX_HTTP_SECURITY_HEADERS_MODULE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_string.h>
+
+
+#define NGX_HTTP_SECURITY_HEADER_OMIT  0
+
+#define NGX_HTTP_XSS_HEADER_OFF        1
+#define NGX_HTTP_XSS_HEADER_ON         2
+#define NGX_HTTP_XSS_HEADER_BLOCK      3
+#define NGX_HTTP_XSS_HEADER_UNSET      4  /* actively remove header */
+
+#define NGX_HTTP_FO_HEADER_SAME        1
+#define NGX_HTTP_FO_HEADER_DENY        2
+
+/* The Referrer Policy header */
+#define NGX_HTTP_RP_HEADER_NO                        1
+#define NGX_HTTP_RP_HEADER_DOWNGRADE                 2
+#define NGX_HTTP_RP_HEADER_SAME_ORIGIN               3
+#define NGX_HTTP_RP_HEADER_ORIGIN                    4
+#define NGX_HTTP_RP_HEADER_STRICT_ORIGIN             5
+#define NGX_HTTP_RP_HEADER_ORIGIN_WHEN_CROSS         6
+#define NGX_HTTP_RP_HEADER_STRICT_ORIG_WHEN_CROSS    7
+#define NGX_HTTP_RP_HEADER_UNSAFE_URL                8
+
+/* Cross-Origin-Resource-Policy */
+#define NGX_HTTP_CORP_HEADER_SAME_SITE      1
+#define NGX_HTTP_CORP_HEADER_SAME_ORIGIN    2
+#define NGX_HTTP_CORP_HEADER_CROSS_ORIGIN   3
+
+/* Cross-Origin-Opener-Policy */
+#define NGX_HTTP_COOP_HEADER_SAME_ORIGIN              1
+#define NGX_HTTP_COOP_HEADER_SAME_ORIGIN_ALLOW_POPUPS 2
+#define NGX_HTTP_COOP_HEADER_UNSAFE_NONE              3
+
+/* Cross-Origin-Embedder-Policy */
+#define NGX_HTTP_COEP_HEADER_REQUIRE_CORP    1
+#define NGX_HTTP_COEP_HEADER_CREDENTIALLESS  2
+#define NGX_HTTP_COEP_HEADER_UNSAFE_NONE     3
+
+/* Headers managed by the module, indexes into the per-request value table */
+#define NGX_HTTP_SECURITY_HEADERS_XCTO       0
+#define NGX_HTTP_SECURITY_HEADERS_XSS        1
+#define NGX_HTTP_SECURITY_HEADERS_HSTS       2
+#define NGX_HTTP_SECURITY_HEADERS_FO         3
+#define NGX_HTTP_SECURITY_HEADERS_RP         4
+#define NGX_HTTP_SECURITY_HEADERS_CORP       5
+#define NGX_HTTP_SECURITY_HEADERS_COOP       6
+#define NGX_HTTP_SECURITY_HEADERS_COEP       7
+#define NGX_HTTP_SECURITY_HEADERS_CSP        8
+#define NGX_HTTP_SECURITY_HEADERS_REPORTING  9   /* Reporting-Endpoints */
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_TO  10
+#define NGX_HTTP_SECURITY_HEADERS_MANAGED    11
+
+/* Managed headers which also go out on 103 Early Hints responses */
+#define NGX_HTTP_SECURITY_HEADERS_INTERIM                                      \
+    ((1 << NGX_HTTP_SECURITY_HEADERS_RP)                                       \
+     |(1 << NGX_HTTP_SECURITY_HEADERS_CORP)                                    \
+     |(1 << NGX_HTTP_SECURITY_HEADERS_COOP)                                    \
+     |(1 << NGX_HTTP_SECURITY_HEADERS_COEP)                                    \
+     |(1 << NGX_HTTP_SECURITY_HEADERS_CSP)                                     \
+     |(1 << NGX_HTTP_SECURITY_HEADERS_REPORTING)                               \
+     |(1 << NGX_HTTP_SECURITY_HEADERS_REPORT_TO))
+
+/* The endpoint name in report-to parameters of the managed headers */
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP  "security-headers"
+
+/* Actions of the header name table */
+#define NGX_HTTP_SECURITY_HEADERS_ACTION_HIDE    1
+#define NGX_HTTP_SECURITY_HEADERS_ACTION_SET     2
+#define NGX_HTTP_SECURITY_HEADERS_ACTION_COOKIE  3
+
+/* Longest header name the name table can match */
+#define NGX_HTTP_SECURITY_HEADERS_NAME_LEN   64
+
+/* Names up to this length are matched a vector at a time */
+#define NGX_HTTP_SECURITY_HEADERS_ROW        32
+
+/* security_headers_csp_learn */
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_OFF       0
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_URI       1
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_LOCATION  2
+#define NGX_HTTP_SECURITY_HEADERS_LEARN_SIZE      (1024 * 1024)
+
+/* security_headers_fetch_isolation */
+#define NGX_HTTP_SECURITY_HEADERS_FETCH_OFF     0
+#define NGX_HTTP_SECURITY_HEADERS_FETCH_ON      1
+#define NGX_HTTP_SECURITY_HEADERS_FETCH_REPORT  2
+#define NGX_HTTP_SECURITY_HEADERS_FETCH_MODES   6
+
+/* security_headers_cookie_flags */
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_OFF       0x0002
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_SECURE    0x0004
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_HTTPONLY  0x0008
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_STRICT    0x0010
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_LAX       0x0020
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_NONE      0x0040
+
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_SAMESITE                             \
+    (NGX_HTTP_SECURITY_HEADERS_COOKIE_STRICT                                  \
+     |NGX_HTTP_SECURITY_HEADERS_COOKIE_LAX                                    \
+     |NGX_HTTP_SECURITY_HEADERS_COOKIE_NONE)
+
+#define NGX_HTTP_SECURITY_HEADERS_COOKIE_FLAGS                                \
+    (NGX_HTTP_SECURITY_HEADERS_COOKIE_SECURE                                  \
+     |NGX_HTTP_SECURITY_HEADERS_COOKIE_HTTPONLY                               \
+     |NGX_HTTP_SECURITY_HEADERS_COOKIE_SAMESITE)
+
+/* Response conditions a plan entry is sent under */
+#define NGX_HTTP_SECURITY_HEADERS_IF_OK        0x0001  /* 200 only */
+#define NGX_HTTP_SECURITY_HEADERS_IF_MODIFIED  0x0002  /* not for 304 */
+#define NGX_HTTP_SECURITY_HEADERS_IF_HTTPS     0x0004
+#define NGX_HTTP_SECURITY_HEADERS_IF_ALL       0x0007
+
+/* Content type classes, each selects a header profile */
+#define NGX_HTTP_SECURITY_HEADERS_TYPES          4
+#define NGX_HTTP_SECURITY_HEADERS_TYPE_STANDARD  0
+#define NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT  1
+#define NGX_HTTP_SECURITY_HEADERS_TYPE_SANDBOX   2
+#define NGX_HTTP_SECURITY_HEADERS_TYPE_NOSNIFF   3
+
+#define NGX_HTTP_SECURITY_HEADERS_CLASS(type)    (1 << (type))
+#define NGX_HTTP_SECURITY_HEADERS_CLASS_ALL      0x000f
+#define NGX_HTTP_SECURITY_HEADERS_CLASS_FULL                                   \
+    (NGX_HTTP_SECURITY_HEADERS_CLASS(NGX_HTTP_SECURITY_HEADERS_TYPE_STANDARD)  \
+     |NGX_HTTP_SECURITY_HEADERS_CLASS(NGX_HTTP_SECURITY_HEADERS_TYPE_DOCUMENT) \
+     |NGX_HTTP_SECURITY_HEADERS_CLASS(NGX_HTTP_SECURITY_HEADERS_TYPE_SANDBOX))
+
+/* Counters of a worker, see ngx_http_security_headers_status.c */
+#define NGX_HTTP_SECURITY_HEADERS_STAT_RESPONSES  0
+#define NGX_HTTP_SECURITY_HEADERS_STAT_HSTS       1
+#define NGX_HTTP_SECURITY_HEADERS_STAT_ADDED      2
+#define NGX_HTTP_SECURITY_HEADERS_STAT_REPLACED                                \
+    (NGX_HTTP_SECURITY_HEADERS_STAT_ADDED + NGX_HTTP_SECURITY_HEADERS_MANAGED)
+#define NGX_HTTP_SECURITY_HEADERS_STAT_REMOVED                                 \
+    (NGX_HTTP_SECURITY_HEADERS_STAT_REPLACED + NGX_HTTP_SECURITY_HEADERS_MANAGED)
+#define NGX_HTTP_SECURITY_HEADERS_STAT_HIDDEN                                  \
+    (NGX_HTTP_SECURITY_HEADERS_STAT_REMOVED + NGX_HTTP_SECURITY_HEADERS_MANAGED)
+
+#define NGX_HTTP_SECURITY_HEADERS_STATUS_JSON        1
+#define NGX_HTTP_SECURITY_HEADERS_STATUS_PROMETHEUS  2
+
+/* Compiled parts of a location configuration shared by equal locations */
+#define NGX_HTTP_SECURITY_HEADERS_SHARE_NAMES  0
+#define NGX_HTTP_SECURITY_HEADERS_SHARE_TYPES  1
+#define NGX_HTTP_SECURITY_HEADERS_SHARE_PLAN   2
+#define NGX_HTTP_SECURITY_HEADERS_SHARE_KINDS  3
+
+/* Scheme metadata trusted from security_headers_trust_from peers */
+#define NGX_HTTP_SECURITY_HEADERS_TRUST_OFF        0x0002
+#define NGX_HTTP_SECURITY_HEADERS_TRUST_XFP        0x0004
+#define NGX_HTTP_SECURITY_HEADERS_TRUST_FORWARDED  0x0008
+#define NGX_HTTP_SECURITY_HEADERS_TRUST_PROXY      0x0010
+
+/* Values the header set of a location is compiled from */
+typedef struct {
+    ngx_flag_t                 hsts_preload;
+
+    ngx_uint_t                 xss;
+    ngx_uint_t                 fo;
+    ngx_uint_t                 rp;
+    ngx_uint_t                 corp;
+    ngx_uint_t                 coop;
+    ngx_uint_t                 coep;
+} ngx_http_security_headers_policy_t;
+
+/* security_headers_report_to: the URL and the headers announcing it */
+typedef struct {
+    ngx_str_t                  url;
+    ngx_str_t                  endpoints;
+    ngx_str_t                  report_to;
+} ngx_http_security_headers_report_t;
+
+/* A ready to send header, an empty value removes the header */
+typedef struct {
+    ngx_str_t                  key;
+    ngx_str_t                  value;
+    u_char                    *lowcase_key;
+    ngx_uint_t                 hash;
+    ngx_uint_t                 index;
+    ngx_uint_t                 conditions;
+    ngx_uint_t                 classes;
+} ngx_http_security_headers_entry_t;
+
+/*
+ * The headers appended to a response of a class under a set of conditions,
+ * prepared once as template elements which are copied into headers_out
+ * with a single memcpy, whatever the HTTP version.
+ */
+typedef struct {
+    ngx_uint_t                 mask;
+    ngx_uint_t                 nelts;
+    ngx_table_elt_t           *elts;
+} ngx_http_security_headers_block_t;
+
+typedef struct {
+    ngx_str_t                  type;
+    ngx_uint_t                 class;
+} ngx_http_security_headers_type_t;
+
+typedef struct {
+    ngx_str_t                  prefix;
+    ngx_str_t                  suffix;
+    ngx_uint_t                 class;
+} ngx_http_security_headers_wildcard_t;
+
+/* Compiled content type map: exact types, then wildcards, then default */
+typedef struct {
+    ngx_hash_t                 exact;
+    ngx_array_t               *wildcards;
+    ngx_uint_t                 default_class;
+} ngx_http_security_headers_types_t;
+
+typedef struct {
+    ngx_radix_tree_t          *tree;
+#if (NGX_HAVE_INET6)
+    ngx_radix_tree_t          *tree6;
+#endif
+    ngx_uint_t                 unix_domain;
+} ngx_http_security_headers_trusted_t;
+
+typedef struct {
+    ngx_uint_t                 action;
+    ngx_uint_t                 index;
+} ngx_http_security_headers_action_t;
+
+/*
+ * Header names table: managed and hidden names in an exact hash, hidden
+ * name prefixes in a second hash probed once per distinct prefix length.
+ * The length range and the first byte bitmap reject most response headers
+ * before they are lowercased.  The exact names which fit in a row are also
+ * packed by length for the vector matchers, see
+ * ngx_http_security_headers_match.c.
+ */
+
+typedef struct {
+    ngx_hash_t                 hash;
+    ngx_hash_t                 prefixes;
+    uint64_t                   prefix_lens;
+    size_t                     min_len;
+    size_t                     max_len;
+    uint32_t                   first[8];
+
+    u_char                    *rows;
+    ngx_http_security_headers_action_t  **row_actions;
+    uint16_t                   row_start[NGX_HTTP_SECURITY_HEADERS_ROW + 2];
+} ngx_http_security_headers_names_t;
+
+typedef ngx_http_security_headers_action_t *
+    (*ngx_http_security_headers_match_pt)(
+    ngx_http_security_headers_names_t *names, u_char *name, size_t len,
+    u_char *buf);
+
+/*
+ * security_headers_host_map: a compiled file of hostnames and policies,
+ * mapped read-only, see ngx_http_security_headers_hosts.c
+ */
+typedef struct {
+    ngx_str_t                  name;
+    u_char                    *start;
+    size_t                     size;
+    ngx_str_t                 *policies;
+    ngx_uint_t                 npolicies;
+    u_char                    *buckets;
+    ngx_uint_t                 mask;
+} ngx_http_security_headers_host_map_t;
+
+/* The header set of a location under a policy of its host map */
+typedef struct {
+    ngx_array_t               *plan;
+    ngx_uint_t                 conditions;
+    ngx_uint_t                 typed;
+    ngx_http_security_headers_block_t  *blocks;
+#if (nginx_version >= 1029000)
+    ngx_http_security_headers_block_t  *interim;
+    ngx_uint_t                 interim_class;
+#endif
+} ngx_http_security_headers_host_plan_t;
+
+typedef struct {
+    ngx_flag_t                 enable;
+    ngx_flag_t                 hide_server_tokens;
+
+    /* the filter variant of the location, picked at merge time */
+    ngx_http_output_header_filter_pt  handler;
+    ngx_flag_t                 subrequests;
+
+    ngx_http_security_headers_policy_t  policy;
+
+    /* Sec-Fetch-Dest bits allowed cross-site, per safe method and mode */
+    ngx_uint_t                 fetch_isolation;
+    ngx_uint_t                 fetch_allow;
+    uint32_t                   fetch_table[2]
+                                          [NGX_HTTP_SECURITY_HEADERS_FETCH_MODES];
+
+    ngx_array_t                *text_types_keys;
+    ngx_array_t               *type_rules;
+    ngx_http_security_headers_types_t  *types;
+
+    ngx_array_t               *plan;
+    ngx_uint_t                 conditions;
+    ngx_uint_t                 typed;
+
+    ngx_flag_t                 preserialize;
+    ngx_http_security_headers_block_t  *blocks;
+    ngx_flag_t                 cache;
+    ngx_uint_t                 csp_learn;
+    ngx_flag_t                 csp_nonce;
+
+#if (nginx_version >= 1029000)
+    /* the headers of 103 Early Hints, of the class of text/html */
+    ngx_http_security_headers_block_t  *interim;
+    ngx_uint_t                 interim_class;
+#endif
+
+    ngx_http_security_headers_trusted_t  *trusted;
+    ngx_uint_t                 trust_scheme;
+
+    ngx_uint_t                 cookie_flags;
+
+    ngx_array_t               *hide;
+    ngx_array_t               *hide_prefixes;
+    ngx_http_security_headers_names_t  *names;
+
+    ngx_uint_t                 status;
+    ngx_flag_t                 hide_upstream;
+
+    ngx_str_t                  policy_id;
+    ngx_uint_t                 policy_index;
+
+    ngx_http_security_headers_host_map_t  *host_map;
+    ngx_http_security_headers_host_plan_t  *host_plans;
+
+    ngx_http_security_headers_report_t  *report;
+
+} ngx_http_security_headers_loc_conf_t;
+
+/*
+ * Runtime policies, see ngx_http_security_headers_policy.c: records are
+ * immutable, a slot points to the current record of a policy id.
+ */
+
+typedef struct {
+    ngx_uint_t                 version;
+    ngx_http_security_headers_policy_t  policy;
+} ngx_http_security_headers_record_t;
+
+typedef struct ngx_http_security_headers_slot_s
+    ngx_http_security_headers_slot_t;
+
+struct ngx_http_security_headers_slot_s {
+    ngx_http_security_headers_record_t *volatile  current;
+    ngx_str_t                  id;
+    ngx_http_security_headers_slot_t  *next;
+};
+
+typedef struct {
+    ngx_uint_t                 version;
+    ngx_http_security_headers_slot_t  *slots;
+} ngx_http_security_headers_policy_sh_t;
+
+/* A policy id of the configuration, with the values it is seeded with */
+typedef struct {
+    ngx_str_t                  id;
+    ngx_http_security_headers_policy_t  policy;
+    ngx_http_security_headers_report_t  *report;
+} ngx_http_security_headers_seed_t;
+
+/* The plan a worker compiled from the current record of a slot */
+typedef struct {
+    ngx_http_security_headers_slot_t  *slot;
+    ngx_uint_t                 version;
+    ngx_pool_t                *pool;
+    ngx_array_t               *plan;
+    ngx_uint_t                 conditions;
+    ngx_uint_t                 typed;
+} ngx_http_security_headers_runtime_t;
+
+/* A compiled part, keyed by the values it is compiled from */
+typedef struct {
+    ngx_str_node_t             sn;
+    ngx_http_security_headers_loc_conf_t  *conf;
+    size_t                     size;
+} ngx_http_security_headers_share_t;
+
+/* The table of compiled parts, lives while the configuration is parsed */
+typedef struct {
+    ngx_rbtree_t               rbtree;
+    ngx_rbtree_node_t          sentinel;
+    ngx_uint_t                 compiled[NGX_HTTP_SECURITY_HEADERS_SHARE_KINDS];
+    ngx_uint_t                 shared[NGX_HTTP_SECURITY_HEADERS_SHARE_KINDS];
+    size_t                     saved;
+} ngx_http_security_headers_shares_t;
+
+/* A hidden name or prefix, its index selects the counter */
+typedef struct {
+    ngx_str_t                  name;
+    ngx_uint_t                 prefix;
+    ngx_http_security_headers_action_t  action;
+} ngx_http_security_headers_hidden_t;
+
+/*
+ * The counters in the security_headers_stats zone, the layout they were
+ * allocated for, and the array of the layout before, still in use by the
+ * workers of the previous cycle
+ */
+typedef struct {
+    ngx_uint_t                 workers;
+    ngx_uint_t                 stride;
+    ngx_uint_t                 hidden;
+    uint32_t                   names;
+    uint64_t                  *counters;
+    uint64_t                  *retired;
+} ngx_http_security_headers_stats_sh_t;
+
+/* A cache entry whose headers have none of the names, see _cache.c */
+typedef struct {
+    uint64_t                   key;
+    ngx_file_uniq_t            uniq;
+    time_t                     date;
+    ngx_array_t               *plan;
+    ngx_http_security_headers_names_t  *names;
+    ngx_uint_t                 version;
+} ngx_http_security_headers_memo_t;
+
+typedef struct {
+    ngx_http_security_headers_names_t  names;
+
+    ngx_array_t                hidden;
+    ngx_uint_t                 builtin;
+
+    ngx_array_t               *upstream_hashes;
+    ngx_http_security_headers_shares_t  *shares;
+
+    ngx_flag_t                 stats;
+    ngx_uint_t                 status;
+    ngx_shm_zone_t            *stats_zone;
+    ngx_uint_t                 stats_workers;
+    ngx_uint_t                 stats_stride;
+    uint32_t                   stats_names;
+    uint64_t                  *counters;
+
+    /* a location enables security_headers or hide_server_tokens */
+    ngx_flag_t                 used;
+
+    /* the configuration refers to the $security_headers_* variables */
+    ngx_flag_t                 track;
+
+    ngx_flag_t                 fetch;
+
+    ngx_flag_t                 cache;
+    ngx_http_security_headers_memo_t  *memo;
+
+    ngx_flag_t                 learn;
+    size_t                     learn_size;
+    ngx_shm_zone_t            *learn_zone;
+    ngx_flag_t                 nonce;
+    /* the entry of a learned or nonce policy, its value is per response */
+    ngx_http_security_headers_entry_t  csp_entry;
+
+    ngx_array_t                policies;
+    ngx_shm_zone_t            *policy_zone;
+    ngx_http_security_headers_runtime_t  *runtime;
+
+    /* the host maps of the cycle, one mapping per file */
+    ngx_array_t               *host_maps;
+
+    ngx_open_file_t           *report_log;
+    ngx_shm_zone_t            *report_zone;
+    size_t                     report_size;
+    ngx_uint_t                 collector;
+#if (NGX_THREADS)
+    ngx_thread_pool_t         *report_thread_pool;
+#endif
+    void                      *reporter;
+} ngx_http_security_headers_main_conf_t;
+
+typedef struct {
+    ngx_str_t                  key;
+    ngx_str_t                  lowcase_key;
+} ngx_http_security_headers_name_t;
+
+/*
+ * The state of security_headers_csp_learn or security_headers_csp_nonce in
+ * a response body, see _learn.c
+ */
+typedef struct ngx_http_security_headers_learn_s
+    ngx_http_security_headers_learn_t;
+
+/*
+ * What the filter did to a response, one bit per managed header and per
+ * hidden name in the words of hidden, for the $security_headers_*
+ * variables, the state of security_headers_csp_learn or
+ * security_headers_csp_nonce in its body, and whether its headers are done
+ */
+typedef struct {
+    uint32_t                   added;
+    uint32_t                   replaced;
+    uint32_t                   removed;
+    ngx_http_security_headers_learn_t  *learn;
+    unsigned                   done:1;
+    ngx_uint_t                 words;
+    uint64_t                   hidden[1];
+} ngx_http_security_headers_ctx_t;
+
+
+extern ngx_module_t  ngx_http_security_headers_module;
+extern ngx_http_security_headers_match_pt  ngx_http_security_headers_match;
+
+extern ngx_http_security_headers_name_t
+    ngx_http_security_headers_managed[NGX_HTTP_SECURITY_HEADERS_MANAGED];
+
+extern ngx_conf_bitmask_t  ngx_http_security_headers_fetch_values[];
+extern ngx_conf_bitmask_t  ngx_http_security_headers_cookie_values[];
+
+
+ngx_int_t ngx_http_security_headers_compile(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+ngx_int_t ngx_http_security_headers_share(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf, ngx_uint_t kind);
+#if (nginx_version >= 1029000)
+ngx_int_t ngx_http_security_headers_interim(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+#endif
+
+ngx_int_t ngx_http_security_headers_upstream_hide(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+
+ngx_int_t ngx_http_security_headers_match_pack(ngx_conf_t *cf,
+    ngx_http_security_headers_names_t *names, ngx_hash_key_t *keys,
+    ngx_uint_t n);
+void ngx_http_security_headers_match_init(ngx_log_t *log);
+
+char *ngx_http_security_headers_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+ngx_int_t ngx_http_security_headers_stats_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf);
+ngx_int_t ngx_http_security_headers_stats_init_module(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf);
+void ngx_http_security_headers_stats_init_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf);
+
+char *ngx_http_security_headers_policy(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+char *ngx_http_security_headers_policy_api(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+ngx_int_t ngx_http_security_headers_policy_register(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+ngx_int_t ngx_http_security_headers_policy_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf);
+ngx_http_security_headers_runtime_t *ngx_http_security_headers_policy_current(
+    ngx_http_request_t *r, ngx_http_security_headers_main_conf_t *smcf,
+    ngx_uint_t index);
+ngx_int_t ngx_http_security_headers_policy_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+ngx_int_t ngx_http_security_headers_policy_apply(ngx_str_t *args,
+    ngx_http_security_headers_policy_t *policy);
+
+ngx_int_t ngx_http_security_headers_fetch_init(ngx_conf_t *cf);
+void ngx_http_security_headers_fetch_compile(
+    ngx_http_security_headers_loc_conf_t *conf);
+
+char *ngx_http_security_headers_cookie_flags(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+ngx_int_t ngx_http_security_headers_cookie_harden(ngx_http_request_t *r,
+    ngx_table_elt_t *h, ngx_uint_t flags);
+
+char *ngx_http_security_headers_host_map(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+ngx_int_t ngx_http_security_headers_host_compile(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf);
+ngx_http_security_headers_host_plan_t *ngx_http_security_headers_host_lookup(
+    ngx_http_request_t *r, ngx_http_security_headers_loc_conf_t *slcf);
+
+char *ngx_http_security_headers_report_to(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+char *ngx_http_security_headers_report_log(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+char *ngx_http_security_headers_report_collector(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+ngx_int_t ngx_http_security_headers_report_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf);
+ngx_int_t ngx_http_security_headers_report_init_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf);
+void ngx_http_security_headers_report_exit_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf);
+
+#if (NGX_OPENSSL)
+ngx_int_t ngx_http_security_headers_learn_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf);
+ngx_int_t ngx_http_security_headers_learn_header(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_learn_t **learnp);
+ngx_http_security_headers_learn_t *ngx_http_security_headers_learn_create(
+    ngx_http_request_t *r, ngx_str_t *nonce);
+ngx_int_t ngx_http_security_headers_nonce_header(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_learn_t **learnp);
+#endif
+
+#if (NGX_HTTP_CACHE)
+ngx_int_t ngx_http_security_headers_cache_init_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf);
+ngx_http_security_headers_memo_t *ngx_http_security_headers_cache_lookup(
+    ngx_http_request_t *r, ngx_http_security_headers_main_conf_t *smcf,
+    ngx_array_t *plan, ngx_http_security_headers_runtime_t *rt,
+    ngx_uint_t *clean);
+void ngx_http_security_headers_cache_record(ngx_http_request_t *r,
+    ngx_http_security_headers_memo_t *memo, ngx_array_t *plan,
+    ngx_http_security_headers_runtime_t *rt, ngx_uint_t clean);
+#endif
+
+
+#endif /* _NGX_HTTP_SECURITY_HEADERS_MODULE_H_INCLUDED_ */
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_csp_nonce sends HTML responses with a
+ * Content-Security-Policy which allows scripts and styles by a nonce fresh
+ * for each response, and the body filter of _learn.c adds the nonce
+ * attribute to every <script> and <style> start tag of the body.
+ *
+ * The nonces are drawn from a buffer of random bytes which each worker
+ * fills from the OpenSSL generator NGX_HTTP_SECURITY_HEADERS_NONCE_BATCH
+ * bytes at a time, so a response does not call into the generator.  The
+ * buffer is first filled in the worker, after fork.
+ */
+
+
+#if (NGX_OPENSSL)
+
+#include <openssl/rand.h>
+
+
+#define NGX_HTTP_SECURITY_HEADERS_NONCE_LEN    16
+#define NGX_HTTP_SECURITY_HEADERS_NONCE_BATCH  4096
+
+#define NGX_HTTP_SECURITY_HEADERS_NONCE_TEXT                                  \
+    ngx_base64_encoded_length(NGX_HTTP_SECURITY_HEADERS_NONCE_LEN)
+
+
+static ngx_int_t ngx_http_security_headers_nonce_draw(ngx_http_request_t *r,
+    u_char *nonce);
+
+
+static u_char  ngx_http_security_headers_nonce_random
+                                        [NGX_HTTP_SECURITY_HEADERS_NONCE_BATCH];
+static size_t  ngx_http_security_headers_nonce_left;
+
+static ngx_str_t  ngx_http_security_headers_nonce_parts[] = {
+    ngx_string("object-src 'none'; base-uri 'self'; script-src 'self' 'nonce-"),
+    ngx_string("' 'strict-dynamic'; style-src 'self' 'nonce-"),
+    ngx_string("'")
+};
+
+static ngx_str_t  ngx_http_security_headers_nonce_report =
+    ngx_string("; report-to " NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP);
+
+
+/*
+ * Adds the policy with a fresh nonce to a successful HTML response, and
+ * has its body filtered to carry the nonce
+ */
+
+ngx_int_t
+ngx_http_security_headers_nonce_header(ngx_http_request_t *r,
+    ngx_http_security_headers_loc_conf_t *slcf,
+    ngx_http_security_headers_entry_t **entries,
+    ngx_http_security_headers_learn_t **learnp)
+{
+    u_char                                 *p;
+    ngx_str_t                               nonce, attr, src;
+    ngx_http_security_headers_entry_t      *entry;
+    ngx_http_security_headers_learn_t      *learn;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    u_char  random[NGX_HTTP_SECURITY_HEADERS_NONCE_LEN];
+
+    /* a nonce is useless without the body which carries it */
+
+    if (r != r->main || r->header_only
+        || r->headers_out.status != NGX_HTTP_OK
+        || (r->headers_out.content_encoding
+            && r->headers_out.content_encoding->value.len))
+    {
+        return NGX_OK;
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    if (ngx_http_security_headers_nonce_draw(r, random) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    nonce.data = ngx_pnalloc(r->pool, NGX_HTTP_SECURITY_HEADERS_NONCE_TEXT);
+    if (nonce.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    src.len = NGX_HTTP_SECURITY_HEADERS_NONCE_LEN;
+    src.data = random;
+
+    ngx_encode_base64(&nonce, &src);
+
+    /* " nonce=" quoted */
+
+    attr.len = sizeof(" nonce=\"\"") - 1 + nonce.len;
+    attr.data = ngx_pnalloc(r->pool, attr.len);
+    if (attr.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(attr.data, " nonce=\"%V\"", &nonce);
+
+    entry = ngx_palloc(r->pool, sizeof(ngx_http_security_headers_entry_t));
+    if (entry == NULL) {
+        return NGX_ERROR;
+    }
+
+    *entry = smcf->csp_entry;
+
+    entry->value.data = ngx_pnalloc(r->pool,
+                                    ngx_http_security_headers_nonce_parts[0].len
+                                    + ngx_http_security_headers_nonce_parts[1].len
+                                    + ngx_http_security_headers_nonce_parts[2].len
+                                    + 2 * nonce.len
+                                    + ngx_http_security_headers_nonce_report.len);
+    if (entry->value.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(entry->value.data,
+                   ngx_http_security_headers_nonce_parts[0].data,
+                   ngx_http_security_headers_nonce_parts[0].len);
+    p = ngx_cpymem(p, nonce.data, nonce.len);
+    p = ngx_cpymem(p, ngx_http_security_headers_nonce_parts[1].data,
+                   ngx_http_security_headers_nonce_parts[1].len);
+    p = ngx_cpymem(p, nonce.data, nonce.len);
+    p = ngx_cpymem(p, ngx_http_security_headers_nonce_parts[2].data,
+                   ngx_http_security_headers_nonce_parts[2].len);
+
+    if (slcf->report) {
+        p = ngx_cpymem(p, ngx_http_security_headers_nonce_report.data,
+                       ngx_http_security_headers_nonce_report.len);
+    }
+
+    entry->value.len = p - entry->value.data;
+
+    learn = ngx_http_security_headers_learn_create(r, &attr);
+    if (learn == NULL) {
+        return NGX_ERROR;
+    }
+
+    entries[NGX_HTTP_SECURITY_HEADERS_CSP] = entry;
+
+    /* the body grows, and it differs from one response to the next */
+
+    ngx_http_clear_content_length(r);
+    ngx_http_clear_accept_ranges(r);
+    ngx_http_weak_etag(r);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: csp nonce \"%V\"", &nonce);
+
+    *learnp = learn;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_nonce_draw(ngx_http_request_t *r, u_char *nonce)
+{
+    u_char  *p;
+
+    if (ngx_http_security_headers_nonce_left
+        < NGX_HTTP_SECURITY_HEADERS_NONCE_LEN)
+    {
+        if (RAND_bytes(ngx_http_security_headers_nonce_random,
+                       NGX_HTTP_SECURITY_HEADERS_NONCE_BATCH)
+            != 1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                          "security headers: RAND_bytes() failed");
+            return NGX_ERROR;
+        }
+
+        ngx_http_security_headers_nonce_left =
+                                          NGX_HTTP_SECURITY_HEADERS_NONCE_BATCH;
+    }
+
+    p = ngx_http_security_headers_nonce_random
+        + NGX_HTTP_SECURITY_HEADERS_NONCE_BATCH
+        - ngx_http_security_headers_nonce_left;
+
+    ngx_memcpy(nonce, p, NGX_HTTP_SECURITY_HEADERS_NONCE_LEN);
+
+    /* the bytes are used once */
+    ngx_memzero(p, NGX_HTTP_SECURITY_HEADERS_NONCE_LEN);
+
+    ngx_http_security_headers_nonce_left -= NGX_HTTP_SECURITY_HEADERS_NONCE_LEN;
+
+    return NGX_OK;
+}
+
+#endif
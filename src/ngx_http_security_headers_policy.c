@@ -0,0 +1,861 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_policy names the header values of locations, so that
+ * security_headers_policy_api can change them at run time without a reload.
+ *
+ * The values of a policy id are an immutable record in a shared memory
+ * zone.  An update allocates a new record, publishes it in the slot of the
+ * id and frees the previous one, all under the slab pool mutex.  On the
+ * request path a worker compares the version of the current record with
+ * the version it compiled, and on a change copies the record and compiles
+ * a plan in a pool of its own; no lock is taken.  A record may be freed
+ * and reused while it is copied, so the copy is only used if the slot
+ * still points to it with the same version afterwards.  Versions are
+ * unique within the zone, and records are written before they are
+ * published.
+ *
+ * A reload seeds the zone again with the configured values.  Slots are
+ * never freed, the workers of the previous cycle may still read them.
+ */
+
+
+static ngx_int_t ngx_http_security_headers_policy_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_security_headers_policy_publish(
+    ngx_slab_pool_t *shpool, ngx_http_security_headers_policy_sh_t *sh,
+    ngx_http_security_headers_slot_t *slot,
+    ngx_http_security_headers_policy_t *policy);
+static ngx_int_t ngx_http_security_headers_policy_handler(
+    ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_policy_local(ngx_connection_t *c);
+static u_char *ngx_http_security_headers_policy_json(u_char *p,
+    ngx_http_security_headers_slot_t *slot,
+    ngx_http_security_headers_record_t *record);
+static ngx_command_t *ngx_http_security_headers_policy_command(
+    ngx_str_t *name);
+
+
+static ngx_str_t  ngx_http_security_headers_policy_zone_name =
+    ngx_string("security_headers_policy");
+
+/* a "security_headers_" directive for every policy value */
+#define NGX_HTTP_SECURITY_HEADERS_POLICY_VALUES  7
+#define NGX_HTTP_SECURITY_HEADERS_VALUE_LEN      32
+
+
+char *
+ngx_http_security_headers_policy(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    char        *rv;
+    u_char       ch;
+    ngx_str_t   *value;
+    ngx_uint_t   i;
+
+    rv = ngx_conf_set_str_slot(cf, cmd, conf);
+
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    value = cf->args->elts;
+
+    if (value[1].len > NGX_HTTP_SECURITY_HEADERS_NAME_LEN) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "policy id \"%V\" is too long", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    /* the id is used in the API arguments and in JSON as is */
+
+    for (i = 0; i < value[1].len; i++) {
+        ch = value[1].data[i];
+
+        if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+              || (ch >= '0' && ch <= '9') || ch == '-' || ch == '_'
+              || ch == '.'))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid policy id \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * Called when a location with a policy id is merged: the locations of an
+ * id must end up with the same values, which seed the zone.
+ */
+
+ngx_int_t
+ngx_http_security_headers_policy_register(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    ngx_uint_t                              i;
+    ngx_http_security_headers_seed_t       *seed;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    seed = smcf->policies.elts;
+
+    for (i = 0; i < smcf->policies.nelts; i++) {
+
+        if (seed[i].id.len != conf->policy_id.len
+            || ngx_strncmp(seed[i].id.data, conf->policy_id.data,
+                           conf->policy_id.len)
+               != 0)
+        {
+            continue;
+        }
+
+        if (ngx_memcmp(&seed[i].policy, &conf->policy,
+                       sizeof(ngx_http_security_headers_policy_t))
+            != 0
+            || (seed[i].report == NULL) != (conf->report == NULL)
+            || (conf->report
+                && (seed[i].report->url.len != conf->report->url.len
+                    || ngx_strncmp(seed[i].report->url.data,
+                                   conf->report->url.data,
+                                   conf->report->url.len)
+                       != 0)))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "security_headers_policy \"%V\" is used "
+                               "with different header values",
+                               &conf->policy_id);
+            return NGX_ERROR;
+        }
+
+        conf->policy_index = i;
+
+        return NGX_OK;
+    }
+
+    seed = ngx_array_push(&smcf->policies);
+    if (seed == NULL) {
+        return NGX_ERROR;
+    }
+
+    seed->id = conf->policy_id;
+    seed->policy = conf->policy;
+    seed->report = conf->report;
+
+    conf->policy_index = smcf->policies.nelts - 1;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_security_headers_policy_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    size_t                             size;
+    ngx_uint_t                         i;
+    ngx_http_security_headers_seed_t  *seed;
+
+    smcf->runtime = ngx_pcalloc(cf->pool, smcf->policies.nelts
+                                    * sizeof(ngx_http_security_headers_runtime_t));
+    if (smcf->runtime == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * a slot, its id and two records per policy, as a record is allocated
+     * before the previous one is freed, doubled for the slab chunk sizes
+     */
+
+    size = 0;
+    seed = smcf->policies.elts;
+
+    for (i = 0; i < smcf->policies.nelts; i++) {
+        size += 2 * (sizeof(ngx_http_security_headers_slot_t)
+                     + seed[i].id.len
+                     + 2 * sizeof(ngx_http_security_headers_record_t));
+    }
+
+    size = 8 * ngx_pagesize + ngx_align(size, ngx_pagesize);
+
+    smcf->policy_zone = ngx_shared_memory_add(cf,
+                                    &ngx_http_security_headers_policy_zone_name,
+                                    size, &ngx_http_security_headers_module);
+    if (smcf->policy_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->policy_zone->init = ngx_http_security_headers_policy_init_zone;
+    smcf->policy_zone->data = smcf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_policy_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data)
+{
+    ngx_http_security_headers_main_conf_t  *smcf = shm_zone->data;
+
+    ngx_int_t                               rc;
+    ngx_uint_t                              i;
+    ngx_slab_pool_t                        *shpool;
+    ngx_http_security_headers_seed_t       *seed;
+    ngx_http_security_headers_slot_t       *slot;
+    ngx_http_security_headers_policy_sh_t  *sh;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (data) {
+        sh = data;
+
+    } else if (shm_zone->shm.exists) {
+        sh = shpool->data;
+
+    } else {
+        sh = ngx_slab_calloc(shpool,
+                             sizeof(ngx_http_security_headers_policy_sh_t));
+        if (sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        shpool->data = sh;
+    }
+
+    shm_zone->data = sh;
+
+    rc = NGX_OK;
+    seed = smcf->policies.elts;
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    for (i = 0; i < smcf->policies.nelts; i++) {
+
+        for (slot = sh->slots; slot; slot = slot->next) {
+            if (slot->id.len == seed[i].id.len
+                && ngx_strncmp(slot->id.data, seed[i].id.data,
+                               seed[i].id.len)
+                   == 0)
+            {
+                break;
+            }
+        }
+
+        if (slot == NULL) {
+            slot = ngx_slab_calloc_locked(shpool,
+                                    sizeof(ngx_http_security_headers_slot_t));
+            if (slot == NULL) {
+                rc = NGX_ERROR;
+                break;
+            }
+
+            slot->id.data = ngx_slab_alloc_locked(shpool, seed[i].id.len);
+            if (slot->id.data == NULL) {
+                ngx_slab_free_locked(shpool, slot);
+                rc = NGX_ERROR;
+                break;
+            }
+
+            slot->id.len = seed[i].id.len;
+            ngx_memcpy(slot->id.data, seed[i].id.data, seed[i].id.len);
+
+            slot->next = sh->slots;
+            sh->slots = slot;
+        }
+
+        if (ngx_http_security_headers_policy_publish(shpool, sh, slot,
+                                                     &seed[i].policy)
+            != NGX_OK)
+        {
+            rc = NGX_ERROR;
+            break;
+        }
+
+        /* the compiled plan of the location is the plan of this version */
+
+        smcf->runtime[i].slot = slot;
+        smcf->runtime[i].version = slot->current->version;
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    if (rc != NGX_OK) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "could not allocate policies in \"%V\" zone",
+                      &shm_zone->shm.name);
+    }
+
+    return rc;
+}
+
+
+/* Called with the slab pool mutex held */
+
+static ngx_int_t
+ngx_http_security_headers_policy_publish(ngx_slab_pool_t *shpool,
+    ngx_http_security_headers_policy_sh_t *sh,
+    ngx_http_security_headers_slot_t *slot,
+    ngx_http_security_headers_policy_t *policy)
+{
+    ngx_http_security_headers_record_t  *record, *old;
+
+    record = ngx_slab_alloc_locked(shpool,
+                                   sizeof(ngx_http_security_headers_record_t));
+    if (record == NULL) {
+        return NGX_ERROR;
+    }
+
+    record->policy = *policy;
+    ngx_memory_barrier();
+
+    record->version = ++sh->version;
+    ngx_memory_barrier();
+
+    old = slot->current;
+    slot->current = record;
+
+    if (old) {
+        ngx_slab_free_locked(shpool, old);
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Returns the runtime state of a policy, with the plan compiled from the
+ * current record, or without a plan while the configured one is current.
+ */
+
+ngx_http_security_headers_runtime_t *
+ngx_http_security_headers_policy_current(ngx_http_request_t *r,
+    ngx_http_security_headers_main_conf_t *smcf, ngx_uint_t index)
+{
+    ngx_uint_t                             version;
+    ngx_conf_t                             cf;
+    ngx_pool_t                            *pool;
+    ngx_http_security_headers_seed_t      *seed;
+    ngx_http_security_headers_record_t    *record;
+    ngx_http_security_headers_runtime_t   *rt;
+    ngx_http_security_headers_loc_conf_t   conf;
+
+    rt = &smcf->runtime[index];
+
+    record = rt->slot->current;
+
+    if (record->version == rt->version) {
+        return rt;
+    }
+
+    ngx_memzero(&conf, sizeof(ngx_http_security_headers_loc_conf_t));
+
+    version = record->version;
+    ngx_memory_barrier();
+
+    conf.policy = record->policy;
+    ngx_memory_barrier();
+
+    seed = smcf->policies.elts;
+    conf.report = seed[index].report;
+
+    if (rt->slot->current != record || record->version != version) {
+
+        /* replaced while copied, try again with a later response */
+
+        return rt;
+    }
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, r->connection->log);
+    if (pool == NULL) {
+        return rt;
+    }
+
+    ngx_memzero(&cf, sizeof(ngx_conf_t));
+
+    cf.pool = pool;
+    cf.temp_pool = pool;
+    cf.log = r->connection->log;
+    cf.cycle = (ngx_cycle_t *) ngx_cycle;
+
+    /*
+     * values point to static tables and to the configuration, the old pool
+     * is not referenced
+     */
+
+    if (ngx_http_security_headers_compile(&cf, &conf) != NGX_OK) {
+        ngx_destroy_pool(pool);
+        return rt;
+    }
+
+    if (rt->pool) {
+        ngx_destroy_pool(rt->pool);
+    }
+
+    rt->pool = pool;
+    rt->plan = conf.plan;
+    rt->conditions = conf.conditions;
+    rt->typed = conf.typed;
+    rt->version = version;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: policy \"%V\" version %ui compiled",
+                   &rt->slot->id, version);
+
+    return rt;
+}
+
+
+/*
+ * $security_headers_policy_version, the version of the current record of
+ * the policy, for the proxy cache key; 0 without a policy.
+ */
+
+ngx_int_t
+ngx_http_security_headers_policy_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    u_char                                 *p;
+    ngx_uint_t                              version;
+    ngx_http_security_headers_loc_conf_t   *slcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    version = 0;
+
+    if (slcf->policy_index != NGX_CONF_UNSET_UINT && smcf->runtime) {
+        version = smcf->runtime[slcf->policy_index].slot->current->version;
+    }
+
+    p = ngx_pnalloc(r->pool, NGX_INT_T_LEN);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(p, "%ui", version) - p;
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+    v->data = p;
+
+    return NGX_OK;
+}
+
+
+char *
+ngx_http_security_headers_policy_api(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_security_headers_policy_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * GET lists the policies of the configuration with their current values.
+ * POST or PUT with "id" and the values to change as arguments, named as
+ * the directives without the "security_headers_" prefix, publishes a new
+ * version:
+ *
+ *     curl -X POST 'http://127.0.0.1/policy?id=shop&frame=deny&coop=omit'
+ */
+
+static ngx_int_t
+ngx_http_security_headers_policy_handler(ngx_http_request_t *r)
+{
+    size_t                                  size;
+    ngx_int_t                               rc;
+    ngx_str_t                               id;
+    ngx_buf_t                              *b;
+    ngx_uint_t                              i, n, update;
+    ngx_chain_t                             out;
+    ngx_slab_pool_t                        *shpool;
+    ngx_http_security_headers_slot_t       *slot;
+    ngx_http_security_headers_record_t     *record;
+    ngx_http_security_headers_policy_t      policy;
+    ngx_http_security_headers_policy_sh_t  *sh;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    if (r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD)) {
+        update = 0;
+
+    } else if (r->method & (NGX_HTTP_POST|NGX_HTTP_PUT)) {
+        update = 1;
+
+    } else {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    if (ngx_http_security_headers_policy_local(r->connection) != NGX_OK) {
+        return NGX_HTTP_FORBIDDEN;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    if (smcf->policy_zone == NULL) {
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    n = update ? 1 : smcf->policies.nelts;
+
+    size = sizeof("{}\n")
+           + n * (NGX_HTTP_SECURITY_HEADERS_NAME_LEN
+                  + sizeof("\"\":{\"version\":,},") + NGX_INT_T_LEN
+                  + NGX_HTTP_SECURITY_HEADERS_POLICY_VALUES
+                    * (sizeof("\"\":\"\",") + 2 * NGX_HTTP_SECURITY_HEADERS_VALUE_LEN));
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    shpool = (ngx_slab_pool_t *) smcf->policy_zone->shm.addr;
+    sh = smcf->policy_zone->data;
+
+    slot = NULL;
+
+    if (update) {
+        if (ngx_http_arg(r, (u_char *) "id", 2, &id) != NGX_OK) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        for (i = 0; i < smcf->policies.nelts; i++) {
+            slot = smcf->runtime[i].slot;
+
+            if (slot->id.len == id.len
+                && ngx_strncmp(slot->id.data, id.data, id.len) == 0)
+            {
+                break;
+            }
+        }
+
+        if (i == smcf->policies.nelts) {
+            return NGX_HTTP_NOT_FOUND;
+        }
+    }
+
+    *b->last++ = '{';
+
+    ngx_shmtx_lock(&shpool->mutex);
+
+    if (update) {
+        policy = slot->current->policy;
+
+        rc = (ngx_http_security_headers_policy_apply(&r->args, &policy)
+              == NGX_OK) ? NGX_OK : NGX_HTTP_BAD_REQUEST;
+
+        if (rc == NGX_OK
+            && ngx_http_security_headers_policy_publish(shpool, sh, slot,
+                                                        &policy)
+               != NGX_OK)
+        {
+            rc = NGX_HTTP_SERVICE_UNAVAILABLE;
+        }
+
+        if (rc != NGX_OK) {
+            ngx_shmtx_unlock(&shpool->mutex);
+            return rc;
+        }
+
+        b->last = ngx_http_security_headers_policy_json(b->last, slot,
+                                                        slot->current);
+
+    } else {
+        for (i = 0; i < smcf->policies.nelts; i++) {
+            if (i) {
+                *b->last++ = ',';
+            }
+
+            slot = smcf->runtime[i].slot;
+            record = slot->current;
+
+            b->last = ngx_http_security_headers_policy_json(b->last, slot,
+                                                            record);
+        }
+    }
+
+    ngx_shmtx_unlock(&shpool->mutex);
+
+    b->last = ngx_cpymem(b->last, "}\n", sizeof("}\n") - 1);
+
+    if (update) {
+        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                      "security_headers_policy \"%V\" updated to version %ui",
+                      &slot->id, slot->current->version);
+    }
+
+    ngx_str_set(&r->headers_out.content_type, "application/json");
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+/* The API is only served over loopback addresses and unix sockets */
+
+static ngx_int_t
+ngx_http_security_headers_policy_local(ngx_connection_t *c)
+{
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    u_char               *p;
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (c->sockaddr->sa_family) {
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return NGX_OK;
+#endif
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) c->sockaddr;
+
+        if (IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr)) {
+            return NGX_OK;
+        }
+
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            p = sin6->sin6_addr.s6_addr;
+            return (p[12] == 127) ? NGX_OK : NGX_DECLINED;
+        }
+
+        return NGX_DECLINED;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) c->sockaddr;
+
+        if ((ntohl(sin->sin_addr.s_addr) >> 24) == 127) {
+            return NGX_OK;
+        }
+
+        /* fall through */
+
+    default:
+        return NGX_DECLINED;
+    }
+}
+
+
+/*
+ * Applies "name=value&..." arguments, of an API request or of a
+ * security_headers_host_map policy, to the policy.  The values are checked
+ * against the same tables the directives use; the "id" of the API is
+ * skipped.
+ */
+
+ngx_int_t
+ngx_http_security_headers_policy_apply(ngx_str_t *args,
+    ngx_http_security_headers_policy_t *policy)
+{
+    u_char           *p, *last, *eq, *amp, *field;
+    ngx_str_t         name, value;
+    ngx_flag_t       *flag;
+    ngx_uint_t       *enm;
+    ngx_command_t    *cmd;
+    ngx_conf_enum_t  *e;
+
+    p = args->data;
+    last = p + args->len;
+
+    for ( /* void */ ; p < last; p = amp + 1) {
+
+        amp = ngx_strlchr(p, last, '&');
+        if (amp == NULL) {
+            amp = last;
+        }
+
+        eq = ngx_strlchr(p, amp, '=');
+        if (eq == NULL) {
+            return NGX_ERROR;
+        }
+
+        name.data = p;
+        name.len = eq - p;
+        value.data = eq + 1;
+        value.len = amp - value.data;
+
+        if (name.len == 2 && ngx_strncmp(name.data, "id", 2) == 0) {
+            continue;
+        }
+
+        cmd = ngx_http_security_headers_policy_command(&name);
+        if (cmd == NULL) {
+            return NGX_ERROR;
+        }
+
+        /* the policy is the same struct inside of the location conf */
+
+        field = (u_char *) policy + cmd->offset
+                - offsetof(ngx_http_security_headers_loc_conf_t, policy);
+
+        if (cmd->set == ngx_conf_set_flag_slot) {
+            flag = (ngx_flag_t *) field;
+
+            if (value.len == 2 && ngx_strncmp(value.data, "on", 2) == 0) {
+                *flag = 1;
+
+            } else if (value.len == 3
+                       && ngx_strncmp(value.data, "off", 3) == 0)
+            {
+                *flag = 0;
+
+            } else {
+                return NGX_ERROR;
+            }
+
+            continue;
+        }
+
+        enm = (ngx_uint_t *) field;
+
+        for (e = cmd->post; e->name.len; e++) {
+            if (e->name.len == value.len
+                && ngx_strncmp(e->name.data, value.data, value.len) == 0)
+            {
+                *enm = e->value;
+                break;
+            }
+        }
+
+        if (e->name.len == 0) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_security_headers_policy_json(u_char *p,
+    ngx_http_security_headers_slot_t *slot,
+    ngx_http_security_headers_record_t *record)
+{
+    u_char           *value;
+    ngx_uint_t        n;
+    ngx_command_t    *cmd;
+    ngx_conf_enum_t  *e;
+
+    p = ngx_sprintf(p, "\"%V\":{\"version\":%ui", &slot->id, record->version);
+
+    for (cmd = ngx_http_security_headers_module.commands; cmd->name.len; cmd++) {
+
+        if (ngx_http_security_headers_policy_command(&cmd->name) == NULL) {
+            continue;
+        }
+
+        value = (u_char *) &record->policy + cmd->offset
+                - offsetof(ngx_http_security_headers_loc_conf_t, policy);
+
+        p = ngx_sprintf(p, ",\"%s\":",
+                        cmd->name.data + sizeof("security_headers_") - 1);
+
+        if (cmd->set == ngx_conf_set_flag_slot) {
+            p = ngx_sprintf(p, "\"%s\"", *(ngx_flag_t *) value ? "on" : "off");
+            continue;
+        }
+
+        n = *(ngx_uint_t *) value;
+
+        for (e = cmd->post; e->name.len; e++) {
+            if (e->value == n) {
+                break;
+            }
+        }
+
+        p = ngx_sprintf(p, "\"%V\"", &e->name);
+    }
+
+    *p++ = '}';
+
+    return p;
+}
+
+
+/*
+ * Finds the directive of a policy value by its name, with or without the
+ * "security_headers_" prefix.
+ */
+
+static ngx_command_t *
+ngx_http_security_headers_policy_command(ngx_str_t *name)
+{
+    size_t          len, prefix;
+    ngx_command_t  *cmd;
+
+    prefix = sizeof("security_headers_") - 1;
+
+    if (name->len > prefix
+        && ngx_strncmp(name->data, "security_headers_", prefix) == 0)
+    {
+        prefix = 0;
+    }
+
+    for (cmd = ngx_http_security_headers_module.commands; cmd->name.len; cmd++) {
+
+        if (cmd->conf != NGX_HTTP_LOC_CONF_OFFSET
+            || cmd->offset < offsetof(ngx_http_security_headers_loc_conf_t,
+                                      policy)
+            || cmd->offset >= offsetof(ngx_http_security_headers_loc_conf_t,
+                                       policy)
+                              + sizeof(ngx_http_security_headers_policy_t))
+        {
+            continue;
+        }
+
+        len = cmd->name.len - prefix;
+
+        if (name->len == len
+            && ngx_strncmp(cmd->name.data + prefix, name->data, len) == 0)
+        {
+            return cmd;
+        }
+    }
+
+    return NULL;
+}
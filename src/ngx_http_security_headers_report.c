@@ -0,0 +1,1047 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * security_headers_report_to announces a report endpoint in the
+ * Reporting-Endpoints and Report-To headers and adds report-to parameters
+ * to COOP, COEP and the sandbox CSP.  security_headers_report_collector
+ * accepts the reports, so report storms never reach the application.
+ *
+ * A report is parsed just enough to find its type, directive, blocked and
+ * document URLs; the values are kept JSON escaped as they came.  Workers
+ * drop reports they have seen recently, keyed by the directive, blocked
+ * and document URLs in a small direct mapped table, and append the rest as
+ * NDJSON lines to a buffer in shared memory.  When the buffer is half full,
+ * or once a second, a worker takes its contents and writes them to the
+ * security_headers_report_log file in a thread pool task, or in the worker
+ * itself when nginx is built without threads.
+ */
+
+
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_SIZE      (1024 * 1024)
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_VALUE     1024
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_SEEN      4096
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_DEDUP     60
+#define NGX_HTTP_SECURITY_HEADERS_REPORT_INTERVAL  1000
+
+
+typedef struct {
+    size_t                     size;
+    size_t                     len;
+    ngx_uint_t                 dropped;
+    u_char                     data[1];
+} ngx_http_security_headers_buffer_t;
+
+
+typedef struct {
+    uint32_t                   hash;
+    time_t                     expires;
+} ngx_http_security_headers_seen_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_fd_t                   fd;
+    u_char                    *buf;
+    size_t                     len;
+    ngx_err_t                  err;
+} ngx_http_security_headers_write_ctx_t;
+
+#endif
+
+
+typedef struct {
+    ngx_http_security_headers_buffer_t  *buffer;
+    ngx_slab_pool_t           *shpool;
+    ngx_open_file_t           *file;
+
+    ngx_http_security_headers_seen_t  *seen;
+
+    u_char                    *buf;
+    ngx_uint_t                 busy;
+    ngx_event_t                event;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t         *thread_pool;
+    ngx_thread_task_t         *task;
+#endif
+} ngx_http_security_headers_reporter_t;
+
+
+typedef struct {
+    ngx_str_t                  type;
+    ngx_str_t                  directive;
+    ngx_str_t                  blocked;
+    ngx_str_t                  document;
+} ngx_http_security_headers_violation_t;
+
+
+static ngx_int_t ngx_http_security_headers_report_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_security_headers_collector_handler(
+    ngx_http_request_t *r);
+static void ngx_http_security_headers_collector_body(ngx_http_request_t *r);
+static ngx_int_t ngx_http_security_headers_collector_cors(
+    ngx_http_request_t *r);
+static ngx_uint_t ngx_http_security_headers_report_parse(
+    ngx_http_request_t *r, u_char *p, u_char *last, ngx_uint_t legacy);
+static u_char *ngx_http_security_headers_report_object(u_char *p,
+    u_char *last, ngx_http_security_headers_violation_t *v);
+static u_char *ngx_http_security_headers_report_string(u_char *p,
+    u_char *last, ngx_str_t *value);
+static void ngx_http_security_headers_report_add(ngx_http_request_t *r,
+    ngx_http_security_headers_violation_t *v);
+static void ngx_http_security_headers_report_flush(
+    ngx_http_security_headers_reporter_t *rp, ngx_log_t *log);
+static void ngx_http_security_headers_report_timer(ngx_event_t *ev);
+#if (NGX_THREADS)
+static void ngx_http_security_headers_report_write_thread(void *data,
+    ngx_log_t *log);
+static void ngx_http_security_headers_report_written(ngx_event_t *ev);
+#endif
+
+
+static ngx_str_t  ngx_http_security_headers_report_zone_name =
+    ngx_string("security_headers_reports");
+
+/* the keys of each value, in the order they are looked for */
+
+static char  *ngx_http_security_headers_report_keys[][4] = {
+    { "type", NULL },
+    { "effectiveDirective", "effective-directive", "violated-directive",
+      NULL },
+    { "blockedURL", "blocked-uri", NULL },
+    { "documentURL", "document-uri", "url", NULL }
+};
+
+
+char *
+ngx_http_security_headers_report_to(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_security_headers_loc_conf_t *slcf = conf;
+
+    ngx_str_t                           *value;
+    ngx_uint_t                           i;
+    ngx_http_security_headers_report_t  *report;
+
+    if (slcf->report != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        slcf->report = NULL;
+        return NGX_CONF_OK;
+    }
+
+    /* the URL goes into a quoted string and into JSON as is */
+
+    for (i = 0; i < value[1].len; i++) {
+        if (value[1].data[i] <= ' ' || value[1].data[i] == '"'
+            || value[1].data[i] == '\\' || value[1].data[i] == 0x7f)
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid report URL \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    report = ngx_palloc(cf->pool, sizeof(ngx_http_security_headers_report_t));
+    if (report == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    report->url = value[1];
+
+    report->endpoints.len = sizeof(NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP
+                                   "=\"\"") - 1
+                            + value[1].len;
+    report->endpoints.data = ngx_pnalloc(cf->pool, report->endpoints.len);
+    if (report->endpoints.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(report->endpoints.data,
+                NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP "=\"%V\"", &value[1]);
+
+    report->report_to.len = sizeof("{\"group\":\""
+                                   NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP
+                                   "\",\"max_age\":86400,"
+                                   "\"endpoints\":[{\"url\":\"\"}]}") - 1
+                            + value[1].len;
+    report->report_to.data = ngx_pnalloc(cf->pool, report->report_to.len);
+    if (report->report_to.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(report->report_to.data,
+                "{\"group\":\"" NGX_HTTP_SECURITY_HEADERS_REPORT_GROUP
+                "\",\"max_age\":86400,\"endpoints\":[{\"url\":\"%V\"}]}",
+                &value[1]);
+
+    slcf->report = report;
+
+    return NGX_CONF_OK;
+}
+
+
+char *
+ngx_http_security_headers_report_log(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_security_headers_main_conf_t *smcf = conf;
+
+    ssize_t      size;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i, threads;
+
+    if (smcf->report_log) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    smcf->report_log = ngx_conf_open_file(cf->cycle, &value[1]);
+    if (smcf->report_log == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->report_size = NGX_HTTP_SECURITY_HEADERS_REPORT_SIZE;
+    threads = 1;
+
+    ngx_str_null(&s);
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "size=", 5) == 0) {
+            s.len = value[i].len - 5;
+            s.data = value[i].data + 5;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR || size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            smcf->report_size = size;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "thread_pool=", 12) == 0) {
+            s.len = value[i].len - 12;
+            s.data = value[i].data + 12;
+
+            threads = (s.len == 3 && ngx_strncmp(s.data, "off", 3) == 0)
+                      ? 0 : 2;
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_THREADS)
+
+    if (threads) {
+        smcf->report_thread_pool = ngx_thread_pool_add(cf,
+                                                   threads == 2 ? &s : NULL);
+        if (smcf->report_thread_pool == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+#else
+
+    if (threads == 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"thread_pool\" requires nginx built "
+                           "--with-threads");
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
+    return NGX_CONF_OK;
+}
+
+
+char *
+ngx_http_security_headers_report_collector(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t               *clcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+    smcf->collector = 1;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_security_headers_collector_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+ngx_int_t
+ngx_http_security_headers_report_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    size_t  size;
+
+    size = ngx_align(sizeof(ngx_http_security_headers_buffer_t)
+                     + smcf->report_size, ngx_pagesize);
+
+    smcf->report_zone = ngx_shared_memory_add(cf,
+                                    &ngx_http_security_headers_report_zone_name,
+                                    8 * ngx_pagesize + size,
+                                    &ngx_http_security_headers_module);
+    if (smcf->report_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->report_zone->init = ngx_http_security_headers_report_init_zone;
+    smcf->report_zone->data = smcf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_report_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data)
+{
+    ngx_http_security_headers_main_conf_t  *smcf = shm_zone->data;
+
+    ngx_slab_pool_t                     *shpool;
+    ngx_http_security_headers_buffer_t  *buffer;
+
+    if (data) {
+        /* the same size, the reports not written yet are kept */
+        shm_zone->data = data;
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    buffer = ngx_slab_alloc(shpool, sizeof(ngx_http_security_headers_buffer_t)
+                                    + smcf->report_size);
+    if (buffer == NULL) {
+        return NGX_ERROR;
+    }
+
+    buffer->size = smcf->report_size;
+    buffer->len = 0;
+    buffer->dropped = 0;
+
+    shm_zone->data = buffer;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_security_headers_report_init_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    ngx_http_security_headers_reporter_t  *rp;
+
+#if (NGX_THREADS)
+    ngx_http_security_headers_write_ctx_t  *ctx;
+#endif
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    rp = ngx_pcalloc(cycle->pool, sizeof(ngx_http_security_headers_reporter_t));
+    if (rp == NULL) {
+        return NGX_ERROR;
+    }
+
+    rp->buffer = smcf->report_zone->data;
+    rp->shpool = (ngx_slab_pool_t *) smcf->report_zone->shm.addr;
+    rp->file = smcf->report_log;
+
+    rp->seen = ngx_pcalloc(cycle->pool, NGX_HTTP_SECURITY_HEADERS_REPORT_SEEN
+                                     * sizeof(ngx_http_security_headers_seen_t));
+    if (rp->seen == NULL) {
+        return NGX_ERROR;
+    }
+
+    rp->buf = ngx_palloc(cycle->pool, rp->buffer->size);
+    if (rp->buf == NULL) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_THREADS)
+
+    rp->thread_pool = smcf->report_thread_pool;
+
+    if (rp->thread_pool) {
+        rp->task = ngx_thread_task_alloc(cycle->pool,
+                                sizeof(ngx_http_security_headers_write_ctx_t));
+        if (rp->task == NULL) {
+            return NGX_ERROR;
+        }
+
+        ctx = rp->task->ctx;
+        ctx->buf = rp->buf;
+
+        rp->task->handler = ngx_http_security_headers_report_write_thread;
+        rp->task->event.handler = ngx_http_security_headers_report_written;
+        rp->task->event.data = rp;
+    }
+
+#endif
+
+    rp->event.handler = ngx_http_security_headers_report_timer;
+    rp->event.data = rp;
+    rp->event.log = cycle->log;
+    rp->event.cancelable = 1;
+
+    ngx_add_timer(&rp->event, NGX_HTTP_SECURITY_HEADERS_REPORT_INTERVAL);
+
+    smcf->reporter = rp;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_security_headers_report_exit_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    ngx_http_security_headers_reporter_t  *rp;
+
+    rp = smcf->reporter;
+
+    if (rp == NULL || rp->busy) {
+        return;
+    }
+
+#if (NGX_THREADS)
+    /* no more thread tasks, the last reports are written in place */
+    rp->thread_pool = NULL;
+#endif
+
+    ngx_http_security_headers_report_flush(rp, cycle->log);
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_collector_handler(ngx_http_request_t *r)
+{
+    ngx_int_t  rc;
+
+    if (r->method == NGX_HTTP_OPTIONS) {
+        rc = ngx_http_discard_request_body(r);
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+
+        if (ngx_http_security_headers_collector_cors(r) != NGX_OK) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        r->headers_out.status = NGX_HTTP_NO_CONTENT;
+        r->header_only = 1;
+
+        return ngx_http_send_header(r);
+    }
+
+    if (r->method != NGX_HTTP_POST) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    r->request_body_in_single_buf = 1;
+
+    rc = ngx_http_read_client_request_body(r,
+                                       ngx_http_security_headers_collector_body);
+
+    if (rc >= NGX_HTTP_SPECIAL_RESPONSE) {
+        return rc;
+    }
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_security_headers_collector_body(ngx_http_request_t *r)
+{
+    u_char                                 *p, *last;
+    size_t                                  len;
+    ngx_buf_t                              *b;
+    ngx_uint_t                              legacy, n;
+    ngx_chain_t                            *cl;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    if (r->request_body == NULL || r->request_body->bufs == NULL) {
+        ngx_http_finalize_request(r, NGX_HTTP_BAD_REQUEST);
+        return;
+    }
+
+    if (r->request_body->temp_file) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                      "security headers: report body is larger than "
+                      "client_body_buffer_size");
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_ENTITY_TOO_LARGE);
+        return;
+    }
+
+    len = 0;
+
+    for (cl = r->request_body->bufs; cl; cl = cl->next) {
+        len += cl->buf->last - cl->buf->pos;
+    }
+
+    cl = r->request_body->bufs;
+
+    if (cl->next == NULL) {
+        p = cl->buf->pos;
+
+    } else {
+        p = ngx_pnalloc(r->pool, len);
+        if (p == NULL) {
+            ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        last = p;
+
+        for ( /* void */ ; cl; cl = cl->next) {
+            b = cl->buf;
+            last = ngx_cpymem(last, b->pos, b->last - b->pos);
+        }
+    }
+
+    last = p + len;
+
+    /* application/csp-report is a single object, reports+json an array */
+
+    legacy = (r->headers_in.content_type
+              && ngx_strlcasestrn(r->headers_in.content_type->value.data,
+                                  r->headers_in.content_type->value.data
+                                  + r->headers_in.content_type->value.len,
+                                  (u_char *) "csp-report", 10 - 1)
+                 != NULL);
+
+    n = ngx_http_security_headers_report_parse(r, p, last, legacy);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "security headers: %ui reports", n);
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    if (n == 0 || smcf->reporter == NULL) {
+        ngx_http_finalize_request(r, n ? NGX_HTTP_SERVICE_UNAVAILABLE
+                                       : NGX_HTTP_BAD_REQUEST);
+        return;
+    }
+
+    if (ngx_http_security_headers_collector_cors(r) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+        return;
+    }
+
+    r->headers_out.status = NGX_HTTP_NO_CONTENT;
+    r->header_only = 1;
+
+    ngx_http_finalize_request(r, ngx_http_send_header(r));
+}
+
+
+/* Reports are sent with CORS from the pages of other origins */
+
+static ngx_int_t
+ngx_http_security_headers_collector_cors(ngx_http_request_t *r)
+{
+    ngx_uint_t        i;
+    ngx_table_elt_t  *h;
+
+    static ngx_str_t  cors[][2] = {
+        { ngx_string("Access-Control-Allow-Origin"), ngx_string("*") },
+        { ngx_string("Access-Control-Allow-Methods"), ngx_string("POST") },
+        { ngx_string("Access-Control-Allow-Headers"),
+          ngx_string("Content-Type") },
+        { ngx_string("Access-Control-Max-Age"), ngx_string("86400") }
+    };
+
+    for (i = 0; i < (r->method == NGX_HTTP_OPTIONS ? 4 : 1); i++) {
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = 1;
+        h->key = cors[i][0];
+        h->value = cors[i][1];
+#if (nginx_version >= 1023000)
+        h->next = NULL;
+#endif
+    }
+
+    return NGX_OK;
+}
+
+
+/* Returns the number of reports found, added or deduplicated */
+
+static ngx_uint_t
+ngx_http_security_headers_report_parse(ngx_http_request_t *r, u_char *p,
+    u_char *last, ngx_uint_t legacy)
+{
+    ngx_uint_t                              n;
+    ngx_http_security_headers_violation_t   v;
+
+    n = 0;
+
+    while (p < last && *p != '[' && *p != '{') {
+        p++;
+    }
+
+    if (p == last) {
+        return 0;
+    }
+
+    if (*p == '[') {
+        p++;
+    }
+
+    while (p < last) {
+
+        if (*p != '{') {
+            p++;
+            continue;
+        }
+
+        ngx_memzero(&v, sizeof(ngx_http_security_headers_violation_t));
+
+        p = ngx_http_security_headers_report_object(p, last, &v);
+
+        if (p == NULL) {
+            break;
+        }
+
+        if (v.type.len == 0 && legacy) {
+            ngx_str_set(&v.type, "csp-violation");
+        }
+
+        ngx_http_security_headers_report_add(r, &v);
+
+        n++;
+
+        if (legacy) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+
+/*
+ * Scans one JSON object and picks the values of the known keys at any
+ * depth, the first key of each list which is found wins.  Returns the end
+ * of the object, or NULL if it is not valid enough.
+ */
+
+static u_char *
+ngx_http_security_headers_report_object(u_char *p, u_char *last,
+    ngx_http_security_headers_violation_t *v)
+{
+    u_char      *q;
+    size_t       len;
+    ngx_str_t    key, value, *values;
+    ngx_uint_t   depth, i, k, rank[4];
+
+    values = &v->type;
+
+    for (i = 0; i < 4; i++) {
+        rank[i] = 4;
+    }
+
+    depth = 0;
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '{':
+        case '[':
+            depth++;
+            p++;
+            continue;
+
+        case '}':
+        case ']':
+            p++;
+
+            if (--depth == 0) {
+                return p;
+            }
+
+            continue;
+
+        case '"':
+            break;
+
+        default:
+            p++;
+            continue;
+        }
+
+        p = ngx_http_security_headers_report_string(p, last, &key);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        for (q = p; q < last && (*q == ' ' || *q == '\t' || *q == '\r'
+                                 || *q == '\n'); q++)
+        {
+            /* void */
+        }
+
+        if (q == last || *q != ':') {
+            continue;
+        }
+
+        for (q++; q < last && (*q == ' ' || *q == '\t' || *q == '\r'
+                               || *q == '\n'); q++)
+        {
+            /* void */
+        }
+
+        if (q == last || *q != '"') {
+            p = q;
+            continue;
+        }
+
+        p = ngx_http_security_headers_report_string(q, last, &value);
+        if (p == NULL) {
+            return NULL;
+        }
+
+        for (i = 0; i < 4; i++) {
+            for (k = 0; k < rank[i] && ngx_http_security_headers_report_keys[i][k];
+                 k++)
+            {
+                len = ngx_strlen(ngx_http_security_headers_report_keys[i][k]);
+
+                if (key.len == len
+                    && ngx_strncmp(key.data,
+                                   ngx_http_security_headers_report_keys[i][k],
+                                   len)
+                       == 0)
+                {
+                    values[i] = value;
+                    rank[i] = k;
+                    break;
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Finds the end of a JSON string, the value stays escaped.  Long values
+ * are cut at an escape sequence boundary.
+ */
+
+static u_char *
+ngx_http_security_headers_report_string(u_char *p, u_char *last,
+    ngx_str_t *value)
+{
+    u_char  *start, *cut;
+
+    start = ++p;
+    cut = NULL;
+
+    while (p < last) {
+
+        if (cut == NULL
+            && p - start >= NGX_HTTP_SECURITY_HEADERS_REPORT_VALUE)
+        {
+            cut = p;
+        }
+
+        if (*p == '"') {
+            value->data = start;
+            value->len = (cut ? cut : p) - start;
+            return p + 1;
+        }
+
+        if (*p < ' ') {
+            return NULL;
+        }
+
+        if (*p == '\\') {
+            if (last - p < 2) {
+                return NULL;
+            }
+
+            p += (p[1] == 'u') ? 6 : 2;
+            continue;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_security_headers_report_add(ngx_http_request_t *r,
+    ngx_http_security_headers_violation_t *v)
+{
+    u_char                                 *p;
+    size_t                                  len;
+    uint32_t                                hash;
+    ngx_http_security_headers_seen_t       *seen;
+    ngx_http_security_headers_buffer_t     *buffer;
+    ngx_http_security_headers_reporter_t   *rp;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+    rp = smcf->reporter;
+
+    if (rp == NULL) {
+        return;
+    }
+
+    ngx_crc32_init(hash);
+    ngx_crc32_update(&hash, v->directive.data, v->directive.len);
+    ngx_crc32_update(&hash, (u_char *) "", 1);
+    ngx_crc32_update(&hash, v->blocked.data, v->blocked.len);
+    ngx_crc32_update(&hash, (u_char *) "", 1);
+    ngx_crc32_update(&hash, v->document.data, v->document.len);
+    ngx_crc32_final(hash);
+
+    seen = &rp->seen[hash % NGX_HTTP_SECURITY_HEADERS_REPORT_SEEN];
+
+    if (seen->hash == hash && seen->expires > ngx_time()) {
+        return;
+    }
+
+    len = sizeof("{\"time\":\"\",\"type\":\"\",\"directive\":\"\","
+                 "\"blocked\":\"\",\"document\":\"\"}\n") - 1
+          + ngx_cached_http_log_iso8601.len
+          + v->type.len + v->directive.len + v->blocked.len
+          + v->document.len;
+
+    buffer = rp->buffer;
+
+    ngx_shmtx_lock(&rp->shpool->mutex);
+
+    if (buffer->len + len > buffer->size) {
+        ngx_shmtx_unlock(&rp->shpool->mutex);
+
+        /*
+         * the flush empties the buffer, unless a write of this worker is
+         * still in flight; the report is dropped if it still does not fit
+         */
+
+        ngx_http_security_headers_report_flush(rp, r->connection->log);
+
+        ngx_shmtx_lock(&rp->shpool->mutex);
+
+        if (buffer->len + len > buffer->size) {
+            buffer->dropped++;
+            ngx_shmtx_unlock(&rp->shpool->mutex);
+            return;
+        }
+    }
+
+    p = buffer->data + buffer->len;
+
+    ngx_sprintf(p, "{\"time\":\"%V\",\"type\":\"%V\",\"directive\":\"%V\","
+                "\"blocked\":\"%V\",\"document\":\"%V\"}\n",
+                &ngx_cached_http_log_iso8601, &v->type, &v->directive,
+                &v->blocked, &v->document);
+
+    buffer->len += len;
+
+    len = buffer->len;
+
+    ngx_shmtx_unlock(&rp->shpool->mutex);
+
+    /* a report dropped on a full buffer is taken again when it repeats */
+
+    seen->hash = hash;
+    seen->expires = ngx_time() + NGX_HTTP_SECURITY_HEADERS_REPORT_DEDUP;
+
+    if (len >= buffer->size / 2) {
+        ngx_http_security_headers_report_flush(rp, r->connection->log);
+    }
+}
+
+
+/*
+ * Takes the shared buffer and writes it out.  A worker has one write in
+ * flight at a time; the file descriptor is duplicated for the thread, so
+ * reopening the log meanwhile does not close it.
+ */
+
+static void
+ngx_http_security_headers_report_flush(
+    ngx_http_security_headers_reporter_t *rp, ngx_log_t *log)
+{
+    size_t                               len;
+    ssize_t                              n;
+    ngx_uint_t                           dropped;
+    ngx_http_security_headers_buffer_t  *buffer;
+
+#if (NGX_THREADS)
+    ngx_http_security_headers_write_ctx_t  *ctx;
+#endif
+
+    if (rp->busy) {
+        return;
+    }
+
+    buffer = rp->buffer;
+
+    ngx_shmtx_lock(&rp->shpool->mutex);
+
+    len = buffer->len;
+    dropped = buffer->dropped;
+
+    ngx_memcpy(rp->buf, buffer->data, len);
+
+    buffer->len = 0;
+    buffer->dropped = 0;
+
+    ngx_shmtx_unlock(&rp->shpool->mutex);
+
+    if (dropped) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "security headers: %ui reports dropped, "
+                      "the report buffer is full", dropped);
+    }
+
+    if (len == 0) {
+        return;
+    }
+
+#if (NGX_THREADS)
+
+    if (rp->thread_pool) {
+        ctx = rp->task->ctx;
+
+        ctx->fd = dup(rp->file->fd);
+
+        if (ctx->fd != NGX_INVALID_FILE) {
+            ctx->len = len;
+            ctx->err = 0;
+
+            if (ngx_thread_task_post(rp->thread_pool, rp->task) == NGX_OK) {
+                rp->busy = 1;
+                return;
+            }
+
+            ngx_close_file(ctx->fd);
+        }
+    }
+
+#endif
+
+    n = ngx_write_fd(rp->file->fd, rp->buf, len);
+
+    if (n != (ssize_t) len) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      rp->file->name.data);
+    }
+}
+
+
+static void
+ngx_http_security_headers_report_timer(ngx_event_t *ev)
+{
+    ngx_http_security_headers_reporter_t  *rp = ev->data;
+
+    if (rp->buffer->len) {
+        ngx_http_security_headers_report_flush(rp, ev->log);
+    }
+
+    if (!ngx_exiting) {
+        ngx_add_timer(ev, NGX_HTTP_SECURITY_HEADERS_REPORT_INTERVAL);
+    }
+}
+
+
+#if (NGX_THREADS)
+
+static void
+ngx_http_security_headers_report_write_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_security_headers_write_ctx_t  *ctx = data;
+
+    u_char   *p;
+    size_t    len;
+    ssize_t   n;
+
+    p = ctx->buf;
+    len = ctx->len;
+
+    while (len) {
+        n = ngx_write_fd(ctx->fd, p, len);
+
+        if (n == -1) {
+            if (ngx_errno == NGX_EINTR) {
+                continue;
+            }
+
+            ctx->err = ngx_errno;
+            break;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    ngx_close_file(ctx->fd);
+}
+
+
+static void
+ngx_http_security_headers_report_written(ngx_event_t *ev)
+{
+    ngx_http_security_headers_reporter_t  *rp = ev->data;
+
+    ngx_http_security_headers_write_ctx_t  *ctx;
+
+    ctx = rp->task->ctx;
+
+    if (ctx->err) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      rp->file->name.data);
+    }
+
+    rp->busy = 0;
+}
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * Counters live in a shared memory zone, one slot per worker.  A worker
+ * only writes its own slot, which is padded to the cache line size, so the
+ * filter updates the counters with plain increments and no locks.  The
+ * status handler sums the slots up.
+ */
+
+
+static ngx_int_t ngx_http_security_headers_stats_init_zone(
+    ngx_shm_zone_t *shm_zone, void *data);
+static ngx_int_t ngx_http_security_headers_status_handler(
+    ngx_http_request_t *r);
+static u_char *ngx_http_security_headers_status_json(u_char *p,
+    ngx_http_security_headers_main_conf_t *smcf, uint64_t *total);
+static u_char *ngx_http_security_headers_status_prometheus(u_char *p,
+    ngx_http_security_headers_main_conf_t *smcf, uint64_t *total);
+
+
+static ngx_str_t  ngx_http_security_headers_stats_zone_name =
+    ngx_string("security_headers_stats");
+
+static char  *ngx_http_security_headers_stat_actions[] = {
+    "added", "replaced", "removed"
+};
+
+
+ngx_int_t
+ngx_http_security_headers_stats_init_conf(ngx_conf_t *cf,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    size_t                               size;
+    uint32_t                             crc;
+    ngx_uint_t                           i, n;
+    ngx_core_conf_t                     *ccf;
+    ngx_http_security_headers_hidden_t  *hidden;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    /*
+     * worker_processes is normally set before the http block; if it is not,
+     * the number of CPUs is a safe guess which is checked in init_module
+     */
+
+    if (ccf->worker_processes != NGX_CONF_UNSET) {
+        smcf->stats_workers = ccf->worker_processes;
+
+    } else {
+        smcf->stats_workers = ngx_max(ngx_ncpu, 1);
+    }
+
+    n = NGX_HTTP_SECURITY_HEADERS_STAT_HIDDEN + smcf->hidden.nelts;
+
+    smcf->stats_stride = ngx_align(n * sizeof(uint64_t), ngx_cacheline_size)
+                         / sizeof(uint64_t);
+
+    /* the hidden names the counters after the managed ones stand for */
+
+    ngx_crc32_init(crc);
+
+    hidden = smcf->hidden.elts;
+
+    for (i = 0; i < smcf->hidden.nelts; i++) {
+        ngx_crc32_update(&crc, hidden[i].name.data, hidden[i].name.len);
+        ngx_crc32_update(&crc, (u_char *) (hidden[i].prefix ? "*\n" : "\n"),
+                         hidden[i].prefix ? 2 : 1);
+    }
+
+    ngx_crc32_final(crc);
+
+    smcf->stats_names = crc;
+
+    /* room for the counters of two layouts at once, see below */
+
+    size = smcf->stats_stride * sizeof(uint64_t) * smcf->stats_workers;
+    size = 8 * ngx_pagesize + 2 * ngx_align(size, ngx_pagesize);
+
+    smcf->stats_zone = ngx_shared_memory_add(cf,
+                                     &ngx_http_security_headers_stats_zone_name,
+                                     size, &ngx_http_security_headers_module);
+    if (smcf->stats_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->stats_zone->init = ngx_http_security_headers_stats_init_zone;
+    smcf->stats_zone->data = smcf;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_stats_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data)
+{
+    ngx_http_security_headers_main_conf_t  *smcf = shm_zone->data;
+
+    size_t                                 size;
+    uint64_t                              *counters;
+    ngx_slab_pool_t                       *shpool;
+    ngx_http_security_headers_stats_sh_t  *sh;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    size = smcf->stats_stride * sizeof(uint64_t) * smcf->stats_workers;
+
+    sh = data;
+
+    if (sh) {
+        shm_zone->data = sh;
+
+        /*
+         * keep counting in the zone of the previous cycle if its counters
+         * have the same layout; a page rounded zone size says nothing
+         * about the number of workers and hidden names
+         */
+
+        if (sh->workers == smcf->stats_workers
+            && sh->stride == smcf->stats_stride
+            && sh->hidden == smcf->hidden.nelts
+            && sh->names == smcf->stats_names)
+        {
+            return NGX_OK;
+        }
+
+        /*
+         * the old workers keep counting in the old array through their own
+         * pointer until they exit, so it is not freed now: it is retired,
+         * and freed on the next change of the layout, by when the workers
+         * which counted in it are long gone
+         */
+
+        if (sh->retired) {
+            ngx_slab_free(shpool, sh->retired);
+        }
+
+        counters = ngx_slab_calloc(shpool, size);
+        if (counters == NULL) {
+            return NGX_ERROR;
+        }
+
+        sh->retired = sh->counters;
+
+    } else {
+        sh = ngx_slab_alloc(shpool,
+                            sizeof(ngx_http_security_headers_stats_sh_t));
+        if (sh == NULL) {
+            return NGX_ERROR;
+        }
+
+        shm_zone->data = sh;
+
+        counters = ngx_slab_calloc(shpool, size);
+        if (counters == NULL) {
+            return NGX_ERROR;
+        }
+
+        sh->retired = NULL;
+    }
+
+    sh->counters = counters;
+
+    sh->workers = smcf->stats_workers;
+    sh->stride = smcf->stats_stride;
+    sh->hidden = smcf->hidden.nelts;
+    sh->names = smcf->stats_names;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_security_headers_stats_init_module(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if ((ngx_uint_t) ccf->worker_processes > smcf->stats_workers) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "security_headers_stats: the zone was sized for %ui "
+                      "workers, set \"worker_processes\" before "
+                      "the \"http\" block", smcf->stats_workers);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_security_headers_stats_init_process(ngx_cycle_t *cycle,
+    ngx_http_security_headers_main_conf_t *smcf)
+{
+    ngx_http_security_headers_stats_sh_t  *sh;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return;
+    }
+
+    sh = smcf->stats_zone->data;
+
+    smcf->counters = sh->counters + ngx_worker * smcf->stats_stride;
+}
+
+
+char *
+ngx_http_security_headers_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_security_headers_loc_conf_t *slcf = conf;
+
+    ngx_str_t                              *value;
+    ngx_http_core_loc_conf_t               *clcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    if (slcf->status) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 1
+        || ngx_strcmp(value[1].data, "json") == 0)
+    {
+        slcf->status = NGX_HTTP_SECURITY_HEADERS_STATUS_JSON;
+
+    } else if (ngx_strcmp(value[1].data, "prometheus") == 0) {
+        slcf->status = NGX_HTTP_SECURITY_HEADERS_STATUS_PROMETHEUS;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid status format \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    smcf->status = 1;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_security_headers_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_security_headers_status_handler(ngx_http_request_t *r)
+{
+    size_t                                  size;
+    uint64_t                               *total, *counters;
+    ngx_int_t                               rc;
+    ngx_buf_t                              *b;
+    ngx_uint_t                              i, w, n;
+    ngx_chain_t                             out;
+    ngx_http_security_headers_loc_conf_t   *slcf;
+    ngx_http_security_headers_main_conf_t  *smcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_security_headers_module);
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_security_headers_module);
+
+    n = NGX_HTTP_SECURITY_HEADERS_STAT_HIDDEN + smcf->hidden.nelts;
+
+    total = ngx_pcalloc(r->pool, n * sizeof(uint64_t));
+    if (total == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    counters = ((ngx_http_security_headers_stats_sh_t *)
+                smcf->stats_zone->data)->counters;
+
+    for (w = 0; w < smcf->stats_workers; w++) {
+        for (i = 0; i < n; i++) {
+            total[i] += counters[i];
+        }
+
+        counters += smcf->stats_stride;
+    }
+
+    if (slcf->status == NGX_HTTP_SECURITY_HEADERS_STATUS_PROMETHEUS) {
+        ngx_str_set(&r->headers_out.content_type,
+                    "text/plain; version=0.0.4");
+
+        size = 1024 + NGX_HTTP_SECURITY_HEADERS_MANAGED
+                      * 3 * (NGX_HTTP_SECURITY_HEADERS_NAME_LEN
+                             + sizeof("nginx_security_headers_managed_total"
+                                      "{header=\"\",action=\"replaced\"} \n")
+                             + NGX_INT64_LEN)
+               + smcf->hidden.nelts
+                 * (NGX_HTTP_SECURITY_HEADERS_NAME_LEN
+                    + sizeof("nginx_security_headers_hidden_total"
+                             "{header=\"*\"} \n")
+                    + NGX_INT64_LEN);
+
+    } else {
+        ngx_str_set(&r->headers_out.content_type, "application/json");
+
+        size = 256 + NGX_HTTP_SECURITY_HEADERS_MANAGED
+                     * (NGX_HTTP_SECURITY_HEADERS_NAME_LEN
+                        + sizeof("\"\":{\"added\":,\"replaced\":,"
+                                 "\"removed\":},")
+                        + 3 * NGX_INT64_LEN)
+               + smcf->hidden.nelts
+                 * (NGX_HTTP_SECURITY_HEADERS_NAME_LEN
+                    + sizeof("\"*\":,") + NGX_INT64_LEN);
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (slcf->status == NGX_HTTP_SECURITY_HEADERS_STATUS_PROMETHEUS) {
+        b->last = ngx_http_security_headers_status_prometheus(b->last, smcf,
+                                                              total);
+
+    } else {
+        b->last = ngx_http_security_headers_status_json(b->last, smcf, total);
+    }
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static u_char *
+ngx_http_security_headers_status_json(u_char *p,
+    ngx_http_security_headers_main_conf_t *smcf, uint64_t *total)
+{
+    ngx_uint_t                           i;
+    ngx_http_security_headers_hidden_t  *hidden;
+
+    p = ngx_sprintf(p, "{\"responses\":%uL,\"hsts\":%uL,\"managed\":{",
+                    total[NGX_HTTP_SECURITY_HEADERS_STAT_RESPONSES],
+                    total[NGX_HTTP_SECURITY_HEADERS_STAT_HSTS]);
+
+    for (i = 0; i < NGX_HTTP_SECURITY_HEADERS_MANAGED; i++) {
+        p = ngx_sprintf(p, "%s\"%V\":{\"added\":%uL,\"replaced\":%uL,"
+                        "\"removed\":%uL}",
+                        i ? "," : "",
+                        &ngx_http_security_headers_managed[i].lowcase_key,
+                        total[NGX_HTTP_SECURITY_HEADERS_STAT_ADDED + i],
+                        total[NGX_HTTP_SECURITY_HEADERS_STAT_REPLACED + i],
+                        total[NGX_HTTP_SECURITY_HEADERS_STAT_REMOVED + i]);
+    }
+
+    p = ngx_cpymem(p, "},\"hidden\":{", sizeof("},\"hidden\":{") - 1);
+
+    hidden = smcf->hidden.elts;
+
+    for (i = 0; i < smcf->hidden.nelts; i++) {
+        p = ngx_sprintf(p, "%s\"%V%s\":%uL",
+                        i ? "," : "", &hidden[i].name,
+                        hidden[i].prefix ? "*" : "",
+                        total[NGX_HTTP_SECURITY_HEADERS_STAT_HIDDEN + i]);
+    }
+
+    return ngx_cpymem(p, "}}\n", sizeof("}}\n") - 1);
+}
+
+
+static u_char *
+ngx_http_security_headers_status_prometheus(u_char *p,
+    ngx_http_security_headers_main_conf_t *smcf, uint64_t *total)
+{
+    ngx_uint_t                           i, a;
+    ngx_http_security_headers_hidden_t  *hidden;
+
+    p = ngx_sprintf(p,
+            "# HELP nginx_security_headers_responses_total "
+            "Responses processed by the security headers filter.\n"
+            "# TYPE nginx_security_headers_responses_total counter\n"
+            "nginx_security_headers_responses_total %uL\n"
+            "# HELP nginx_security_headers_hsts_total "
+            "Responses sent with Strict-Transport-Security.\n"
+            "# TYPE nginx_security_headers_hsts_total counter\n"
+            "nginx_security_headers_hsts_total %uL\n"
+            "# HELP nginx_security_headers_managed_total "
+            "Managed headers added, replaced or removed.\n"
+            "# TYPE nginx_security_headers_managed_total counter\n",
+            total[NGX_HTTP_SECURITY_HEADERS_STAT_RESPONSES],
+            total[NGX_HTTP_SECURITY_HEADERS_STAT_HSTS]);
+
+    for (i = 0; i < NGX_HTTP_SECURITY_HEADERS_MANAGED; i++) {
+        for (a = 0; a < 3; a++) {
+            p = ngx_sprintf(p, "nginx_security_headers_managed_total"
+                            "{header=\"%V\",action=\"%s\"} %uL\n",
+                            &ngx_http_security_headers_managed[i].lowcase_key,
+                            ngx_http_security_headers_stat_actions[a],
+                            total[NGX_HTTP_SECURITY_HEADERS_STAT_ADDED
+                                  + a * NGX_HTTP_SECURITY_HEADERS_MANAGED
+                                  + i]);
+        }
+    }
+
+    p = ngx_sprintf(p,
+            "# HELP nginx_security_headers_hidden_total "
+            "Leaking headers hidden from responses.\n"
+            "# TYPE nginx_security_headers_hidden_total counter\n");
+
+    hidden = smcf->hidden.elts;
+
+    for (i = 0; i < smcf->hidden.nelts; i++) {
+        p = ngx_sprintf(p, "nginx_security_headers_hidden_total"
+                        "{header=\"%V%s\"} %uL\n",
+                        &hidden[i].name, hidden[i].prefix ? "*" : "",
+                        total[NGX_HTTP_SECURITY_HEADERS_STAT_HIDDEN + i]);
+    }
+
+    return p;
+}
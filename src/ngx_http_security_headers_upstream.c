@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include "ngx_http_security_headers_module.h"
+
+
+/*
+ * With security_headers_hide_upstream, the hidden names are added to the
+ * hide_headers_hash of the upstream modules, the one proxy_hide_header
+ * fills, so upstream headers with these names are never copied into
+ * r->headers_out.  The filter still hides the names in responses which are
+ * not proxied, and the prefixes, which an exact hash cannot match.
+ *
+ * The configuration of every upstream module below starts with
+ * ngx_http_upstream_conf_t.  The modules are looked up by name, as any of
+ * them may be compiled out.
+ */
+
+
+typedef struct {
+    ngx_hash_elt_t           **buckets;
+    ngx_array_t               *hide;
+    ngx_hash_t                 hash;
+} ngx_http_security_headers_upstream_hash_t;
+
+
+static ngx_int_t ngx_http_security_headers_upstream_hash(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf, ngx_hash_t *hash);
+
+
+static char  *ngx_http_security_headers_upstream_modules[] = {
+    "ngx_http_proxy_module",
+    "ngx_http_fastcgi_module",
+    "ngx_http_uwsgi_module",
+    "ngx_http_scgi_module",
+    "ngx_http_grpc_module",
+    NULL
+};
+
+
+ngx_int_t
+ngx_http_security_headers_upstream_hide(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf)
+{
+    char                      **name;
+    ngx_uint_t                  i;
+    ngx_module_t               *module;
+    ngx_http_conf_ctx_t        *ctx;
+    ngx_http_upstream_conf_t   *ucf;
+
+    ctx = cf->ctx;
+
+    for (i = 0; cf->cycle->modules[i]; i++) {
+        module = cf->cycle->modules[i];
+
+        if (module->type != NGX_HTTP_MODULE) {
+            continue;
+        }
+
+        for (name = ngx_http_security_headers_upstream_modules;
+             *name;
+             name++)
+        {
+            if (ngx_strcmp(module->name, *name) == 0) {
+                break;
+            }
+        }
+
+        if (*name == NULL) {
+            continue;
+        }
+
+        /* the upstream modules are merged before this filter */
+
+        ucf = ctx->loc_conf[module->ctx_index];
+
+        if (ucf == NULL || ucf->hide_headers_hash.buckets == NULL) {
+            continue;
+        }
+
+        if (ngx_http_security_headers_upstream_hash(cf, conf,
+                                                    &ucf->hide_headers_hash)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * Replaces the hash with a copy extended by the hidden names.  Locations
+ * inherit both the upstream hash and the hidden names from the enclosing
+ * level, so the copies are cached by the pair.
+ */
+
+static ngx_int_t
+ngx_http_security_headers_upstream_hash(ngx_conf_t *cf,
+    ngx_http_security_headers_loc_conf_t *conf, ngx_hash_t *hash)
+{
+    size_t                                      len;
+    ngx_str_t                                  *name;
+    ngx_uint_t                                  i, n, key;
+    ngx_array_t                                 keys;
+    ngx_hash_elt_t                             *elt;
+    ngx_hash_key_t                             *hk;
+    ngx_hash_init_t                             hinit;
+    ngx_http_security_headers_hidden_t         *hidden;
+    ngx_http_security_headers_main_conf_t      *smcf;
+    ngx_http_security_headers_upstream_hash_t  *uh;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf,
+                                              ngx_http_security_headers_module);
+
+    if (smcf->upstream_hashes == NULL) {
+        smcf->upstream_hashes = ngx_array_create(cf->pool, 4,
+                                sizeof(ngx_http_security_headers_upstream_hash_t));
+        if (smcf->upstream_hashes == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    uh = smcf->upstream_hashes->elts;
+
+    for (i = 0; i < smcf->upstream_hashes->nelts; i++) {
+        if (uh[i].hide == conf->hide && uh[i].buckets == hash->buckets) {
+            *hash = uh[i].hash;
+            return NGX_OK;
+        }
+    }
+
+    if (ngx_array_init(&keys, cf->temp_pool, 32, sizeof(ngx_hash_key_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    len = 0;
+
+    /* the names already in the hash */
+
+    for (i = 0; i < hash->size; i++) {
+
+        elt = hash->buckets[i];
+
+        if (elt == NULL) {
+            continue;
+        }
+
+        while (elt->value) {
+            hk = ngx_array_push(&keys);
+            if (hk == NULL) {
+                return NGX_ERROR;
+            }
+
+            hk->key.len = elt->len;
+            hk->key.data = elt->name;
+            hk->key_hash = ngx_hash_key(elt->name, elt->len);
+            hk->value = elt->value;
+
+            len = ngx_max(len, elt->len);
+
+            elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
+                                                   sizeof(void *));
+        }
+    }
+
+    /* the built-in hidden names, then security_headers_hide */
+
+    hidden = smcf->hidden.elts;
+    n = smcf->builtin + (conf->hide ? conf->hide->nelts : 0);
+
+    for (i = 0; i < n; i++) {
+
+        name = (i < smcf->builtin) ? &hidden[i].name
+                                   : &((ngx_str_t *) conf->hide->elts)
+                                                           [i - smcf->builtin];
+
+        key = ngx_hash_key(name->data, name->len);
+
+        if (ngx_hash_find(hash, key, name->data, name->len)) {
+            continue;
+        }
+
+        hk = ngx_array_push(&keys);
+        if (hk == NULL) {
+            return NGX_ERROR;
+        }
+
+        hk->key = *name;
+        hk->key_hash = key;
+        hk->value = (void *) 1;
+
+        len = ngx_max(len, name->len);
+    }
+
+    uh = ngx_array_push(smcf->upstream_hashes);
+    if (uh == NULL) {
+        return NGX_ERROR;
+    }
+
+    uh->buckets = hash->buckets;
+    uh->hide = conf->hide;
+
+    hinit.hash = &uh->hash;
+    hinit.key = ngx_hash_key_lc;
+    hinit.max_size = 2048;
+    hinit.bucket_size = ngx_align(ngx_max(128, len + 2 + 2 * sizeof(void *)),
+                                  ngx_cacheline_size);
+    hinit.name = "security_headers_upstream_hide_hash";
+    hinit.pool = cf->pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, keys.elts, keys.nelts) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "security headers: upstream hide hash of %ui names, "
+                   "%ui cached", keys.nelts, smcf->upstream_hashes->nelts);
+
+    *hash = uh->hash;
+
+    return NGX_OK;
+}
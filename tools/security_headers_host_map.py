@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Danila Vershinin ( https://www.getpagespeed.com )
+#
+# Compiles a host map for the security_headers_host_map directive.
+#
+# The input has a hostname and its policy values on each line:
+#
+#     # host              values
+#     example.com         frame=deny hsts_preload=off
+#     *.example.org       corp=cross-origin coop=same-origin
+#
+# The values are named as in the policy API, the directive names without
+# "security_headers_", and apply over the values of the location.  nginx
+# checks them when it loads the map.  Names are lowercased, international
+# ones are given in punycode; "*.example.org" matches the subdomains of
+# example.org, not example.org itself.
+#
+# The output is written next to the target and renamed over it, so that
+# running workers keep the old file mapped until the reload.
+#
+# usage: security_headers_host_map.py hosts.txt hosts.map
+
+import os
+import struct
+import sys
+
+
+MAGIC = b"SHHM"
+VERSION = 1
+
+HEADER = struct.Struct("<4sIIIII")
+REF = struct.Struct("<II")
+BUCKET = struct.Struct("<IIHH")
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h ^= b
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+
+def parse(lines):
+    hosts = {}
+    policies = {}
+
+    for n, line in enumerate(lines, 1):
+        line = line.split("#", 1)[0].split()
+        if not line:
+            continue
+
+        host = line[0].lower().rstrip(".")
+
+        if host.startswith("*."):
+            host = host[1:]
+
+        if (not host or "*" in host or len(host) > 255
+            or not host.isascii()):
+            raise ValueError("line %d: invalid host \"%s\"" % (n, line[0]))
+
+        values = {}
+
+        for value in line[1:]:
+            name, eq, arg = value.partition("=")
+            if not eq or not name or not arg or "&" in value:
+                raise ValueError("line %d: invalid value \"%s\"" % (n, value))
+            if name in values:
+                raise ValueError("line %d: duplicate \"%s\"" % (n, name))
+            values[name] = arg
+
+        if host in hosts:
+            raise ValueError("line %d: duplicate host \"%s\"" % (n, line[0]))
+
+        # equal policies are stored once, whatever the order of the values
+
+        policy = "&".join("%s=%s" % v for v in sorted(values.items()))
+        hosts[host] = policies.setdefault(policy, len(policies))
+
+        if len(policies) > 0xffff:
+            raise ValueError("line %d: too many distinct policies" % n)
+
+    return hosts, policies
+
+
+def compile_map(hosts, policies):
+    nbuckets = 1
+    while nbuckets < 2 * len(hosts):
+        nbuckets *= 2
+
+    start = HEADER.size + len(policies) * REF.size + nbuckets * BUCKET.size
+
+    strings = bytearray()
+    refs = []
+
+    for policy in sorted(policies, key=policies.get):
+        data = policy.encode("ascii")
+        refs.append(REF.pack(start + len(strings), len(data)))
+        strings += data
+
+    buckets = [None] * nbuckets
+
+    for host, policy in hosts.items():
+        data = host.encode("ascii")
+        h = fnv1a(data)
+        i = h & (nbuckets - 1)
+
+        while buckets[i] is not None:
+            i = (i + 1) & (nbuckets - 1)
+
+        buckets[i] = BUCKET.pack(h, start + len(strings), len(data), policy)
+        strings += data
+
+    empty = BUCKET.pack(0, 0, 0, 0)
+
+    return b"".join([HEADER.pack(MAGIC, VERSION, len(policies), nbuckets,
+                                 len(hosts), 0)]
+                    + refs
+                    + [b if b is not None else empty for b in buckets]
+                    + [bytes(strings)])
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write("usage: %s hosts.txt hosts.map\n" % argv[0])
+        return 2
+
+    try:
+        with open(argv[1], encoding="utf-8") as f:
+            hosts, policies = parse(f)
+    except (OSError, ValueError) as e:
+        sys.stderr.write("%s: %s\n" % (argv[1], e))
+        return 1
+
+    data = compile_map(hosts, policies)
+
+    tmp = "%s.%d.tmp" % (argv[2], os.getpid())
+
+    with open(tmp, "wb") as f:
+        f.write(data)
+
+    os.replace(tmp, argv[2])
+
+    sys.stdout.write("%s: %d hosts, %d policies, %d bytes\n"
+                     % (argv[2], len(hosts), len(policies), len(data)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))